@@ -85,16 +85,43 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 20
 
+/*
+ * The think time of a queue is a decaying average, in usec, of the time
+ * between the queue running empty and its next request. The samples
+ * count saturates at 256; the average is trusted after 80, as in CFQ.
+ */
+#define ROW_TTIME_SAMPLES_VALID	80
+
+/*
+ * Dispatch latency histogram buckets: bucket i counts the requests that
+ * waited less than 2^i msec in the scheduler, the last one all others.
+ */
+#define ROW_LAT_BUCKETS		10
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
  *			to the queue
  * @begin_idling:	flag indicating wether we should idle
+ * @empty_time:		time the queue last ran empty
+ * @ttime_samples:	weight of the think time average
+ * @ttime_total:	weighted sum of think time samples
+ * @ttime_mean:		think time of the queue (usec)
+ * @idle_hits:		idle periods ended by a new request
+ * @idle_misses:	idle periods that expired
  *
  */
 struct rowq_idling_data {
 	ktime_t			last_insert_time;
 	bool			begin_idling;
+
+	ktime_t			empty_time;
+	unsigned long		ttime_samples;
+	unsigned long		ttime_total;
+	unsigned long		ttime_mean;
+
+	unsigned int		idle_hits;
+	unsigned int		idle_misses;
 };
 
 /**
@@ -109,6 +136,9 @@ struct rowq_idling_data {
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
  * @idle_data:		data for idling on queues
+ * @nr_urgent:		urgent requests added to the queue
+ * @nr_preempt:		times the queue preempted a lower priority one
+ * @disp_lat:		dispatch latency histogram
  *
  */
 struct row_queue {
@@ -124,6 +154,10 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	unsigned int		nr_urgent;
+	unsigned int		nr_preempt;
+	unsigned int		disp_lat[ROW_LAT_BUCKETS];
 };
 
 /**
@@ -131,12 +165,15 @@ struct row_queue {
  * @idle_time:		idling duration (jiffies)
  * @freq:		min time between two requests that
  *			triger idling (msec)
+ * @adaptive:		idle only on queues whose think time is
+ *			shorter than @idle_time
  * @idle_work:		pointer to struct delayed_work
  *
  */
 struct idling_data {
 	unsigned long			idle_time;
 	u32				freq;
+	int				adaptive;
 
 	struct workqueue_struct	*idle_workqueue;
 	struct delayed_work		idle_work;
@@ -169,6 +206,8 @@ struct row_data {
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* insertion time in usec, truncated to unsigned long */
+#define RQ_INSERT_US(rq) ((unsigned long) ((rq)->elevator_private[1]))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -207,6 +246,66 @@ static inline void __maybe_unused row_dump_queues_stat(struct row_data *rd)
 }
 
 /******************** Static helper functions ***********************/
+/*
+ * row_update_ttime() - Account a think time sample of a queue
+ * @rd:		pointer to struct row_data
+ * @rqueue:	queue the sample belongs to
+ * @ttime:	think time sample (usec)
+ *
+ * Samples are capped at twice the idle period; anything longer is
+ * equally useless for idling.
+ */
+static void row_update_ttime(struct row_data *rd, struct row_queue *rqueue,
+			     u64 ttime)
+{
+	struct rowq_idling_data *idle_data = &rqueue->idle_data;
+	unsigned long sample = 2 * jiffies_to_usecs(rd->read_idle.idle_time);
+
+	if (ttime < sample)
+		sample = ttime;
+
+	idle_data->ttime_samples = (7 * idle_data->ttime_samples + 256) / 8;
+	idle_data->ttime_total = (7 * idle_data->ttime_total + 256 * sample) / 8;
+	idle_data->ttime_mean = (idle_data->ttime_total + 128) /
+		idle_data->ttime_samples;
+}
+
+/*
+ * row_idle_worthwhile() - Check whether idling may pay off on a queue
+ * @rd:		pointer to struct row_data
+ * @rqueue:	queue to check
+ *
+ * Idling only pays off if the next request of the queue usually
+ * arrives before the idle period is over.
+ */
+static bool row_idle_worthwhile(struct row_data *rd, struct row_queue *rqueue)
+{
+	if (!rd->read_idle.adaptive ||
+	    rqueue->idle_data.ttime_samples < ROW_TTIME_SAMPLES_VALID)
+		return true;
+
+	return rqueue->idle_data.ttime_mean <
+		jiffies_to_usecs(rd->read_idle.idle_time);
+}
+
+/*
+ * row_account_dispatch() - Account the dispatch of a request
+ * @rqueue:	queue the request is dispatched from
+ * @rq:		dispatched request
+ *
+ */
+static void row_account_dispatch(struct row_queue *rqueue, struct request *rq)
+{
+	unsigned long now = (unsigned long)ktime_to_us(ktime_get());
+	unsigned long lat_ms = (now - RQ_INSERT_US(rq)) / USEC_PER_MSEC;
+	int bucket = min_t(int, fls_long(lat_ms), ROW_LAT_BUCKETS - 1);
+
+	rqueue->disp_lat[bucket]++;
+
+	if (!rqueue->nr_req)
+		rqueue->idle_data.empty_time = ktime_get();
+}
+
 /*
  * kick_queue() - Wake up device driver queue thread
  * @work:	pointer to struct work_struct
@@ -223,17 +322,29 @@ static void kick_queue(struct work_struct *work)
 	struct row_data *rd =
 		container_of(read_data, struct row_data, read_idle);
 
+	struct row_queue *rqueue;
+
+	spin_lock_irq(rd->dispatch_queue->queue_lock);
+	rqueue = &rd->row_queues[rd->curr_queue];
 	row_log_rowq(rd, rd->curr_queue, "Performing delayed work");
 	/* Mark idling process as done */
-	rd->row_queues[rd->curr_queue].idle_data.begin_idling = false;
+	rqueue->idle_data.begin_idling = false;
+
+	/*
+	 * No request came in time: count the idle period as the longest
+	 * think time, so that a queue that keeps missing stops idling.
+	 */
+	if (!rqueue->nr_req) {
+		rqueue->idle_data.idle_misses++;
+		row_update_ttime(rd, rqueue, ULLONG_MAX);
+		rqueue->idle_data.empty_time = ktime_set(0, 0);
+	}
 
 	if (!(rd->nr_reqs[0] + rd->nr_reqs[1]))
 		row_log(rd->dispatch_queue, "No requests in scheduler");
-	else {
-		spin_lock_irq(rd->dispatch_queue->queue_lock);
+	else
 		__blk_run_queue(rd->dispatch_queue);
-		spin_unlock_irq(rd->dispatch_queue->queue_lock);
-	}
+	spin_unlock_irq(rd->dispatch_queue->queue_lock);
 }
 
 /*
@@ -276,19 +387,28 @@ static void row_add_request(struct request_queue *q,
 {
 	struct row_data *rd = (struct row_data *)q->elevator->elevator_data;
 	struct row_queue *rqueue = RQ_ROWQ(rq);
+	ktime_t now = ktime_get();
+
+	if (row_queues_def[rqueue->prio].idling_enabled &&
+	    !rqueue->nr_req && ktime_to_ns(rqueue->idle_data.empty_time))
+		row_update_ttime(rd, rqueue, ktime_us_delta(now,
+				 rqueue->idle_data.empty_time));
 
 	list_add_tail(&rq->queuelist, &rqueue->fifo);
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	rq->elevator_private[1] = (void *)(unsigned long)ktime_to_us(now);
 
 	if (row_queues_def[rqueue->prio].idling_enabled) {
-		if (delayed_work_pending(&rd->read_idle.idle_work))
-			(void)cancel_delayed_work(
-				&rd->read_idle.idle_work);
-		if (ktime_to_ms(ktime_sub(ktime_get(),
+		if (delayed_work_pending(&rd->read_idle.idle_work) &&
+		    cancel_delayed_work(&rd->read_idle.idle_work) &&
+		    rqueue->prio == rd->curr_queue)
+			rqueue->idle_data.idle_hits++;
+		if (ktime_to_ms(ktime_sub(now,
 				rqueue->idle_data.last_insert_time)) <
-				rd->read_idle.freq) {
+				rd->read_idle.freq &&
+		    row_idle_worthwhile(rd, rqueue)) {
 			rqueue->idle_data.begin_idling = true;
 			row_log_rowq(rd, rqueue->prio, "Enable idling");
 		} else {
@@ -296,10 +416,11 @@ static void row_add_request(struct request_queue *q,
 			row_log_rowq(rd, rqueue->prio, "Disable idling");
 		}
 
-		rqueue->idle_data.last_insert_time = ktime_get();
+		rqueue->idle_data.last_insert_time = now;
 	}
 	if (row_queues_def[rqueue->prio].is_urgent &&
 	    row_rowq_unserved(rd, rqueue->prio)) {
+		rqueue->nr_urgent++;
 		row_log_rowq(rd, rqueue->prio,
 			"added urgent request (total on queue=%d)",
 			rqueue->nr_req);
@@ -395,6 +516,7 @@ static void row_dispatch_insert(struct row_data *rd)
 
 	rq = rq_entry_fifo(rd->row_queues[rd->curr_queue].fifo.next);
 	row_remove_request(rd->dispatch_queue, rq);
+	row_account_dispatch(&rd->row_queues[rd->curr_queue], rq);
 	elv_dispatch_add_tail(rd->dispatch_queue, rq);
 	rd->row_queues[rd->curr_queue].nr_dispatched++;
 	row_clear_rowq_unserved(rd, rd->curr_queue);
@@ -461,6 +583,7 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 			row_log_rowq(rd, currq,
 				" Preemting for unserved rowq%d. (nr_req=%u)",
 				i, rd->row_queues[currq].nr_req);
+			rd->row_queues[i].nr_preempt++;
 			rd->curr_queue = i;
 			row_dispatch_insert(rd);
 			ret = 1;
@@ -561,6 +684,7 @@ static void *row_init_queue(struct request_queue *q)
 	if (!rdata->read_idle.idle_time)
 		rdata->read_idle.idle_time = 1;
 	rdata->read_idle.freq = ROW_READ_FREQ_MSEC;
+	rdata->read_idle.adaptive = 1;
 	rdata->read_idle.idle_workqueue = alloc_workqueue("row_idle_work",
 					    WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
 	if (!rdata->read_idle.idle_workqueue)
@@ -693,6 +817,7 @@ SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum, 0);
 SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 0);
 SHOW_FUNCTION(row_read_idle_freq_show, rowd->read_idle.freq, 0);
+SHOW_FUNCTION(row_read_idle_adaptive_show, rowd->read_idle.adaptive, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -733,9 +858,88 @@ STORE_FUNCTION(row_lp_swrite_quantum_store,
 			1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time, 1, INT_MAX, 0);
 STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq, 1, INT_MAX, 0);
+STORE_FUNCTION(row_read_idle_adaptive_store, &rowd->read_idle.adaptive,
+			0, 1, 0);
 
 #undef STORE_FUNCTION
 
+/*
+ * One line per queue: think time (usec), idle hits and misses, urgent
+ * requests and preemptions. Writing anything resets the counters.
+ */
+static ssize_t row_queue_stats_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct row_queue *rqueue;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rqueue = &rowd->row_queues[i];
+		len += snprintf(page + len, PAGE_SIZE - len,
+				"rowq%d %lu %u %u %u %u\n", i,
+				rqueue->idle_data.ttime_mean,
+				rqueue->idle_data.idle_hits,
+				rqueue->idle_data.idle_misses,
+				rqueue->nr_urgent, rqueue->nr_preempt);
+	}
+
+	return len;
+}
+
+static ssize_t row_queue_stats_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct row_queue *rqueue;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rqueue = &rowd->row_queues[i];
+		rqueue->idle_data.idle_hits = 0;
+		rqueue->idle_data.idle_misses = 0;
+		rqueue->nr_urgent = 0;
+		rqueue->nr_preempt = 0;
+	}
+
+	return count;
+}
+
+/*
+ * One line per queue, ROW_LAT_BUCKETS columns: column i counts the
+ * requests dispatched after less than 2^i msec in the scheduler, the
+ * last one all the others. Writing anything clears the histograms.
+ */
+static ssize_t row_dispatch_latency_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	ssize_t len = 0;
+	int i, j;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		len += snprintf(page + len, PAGE_SIZE - len, "rowq%d", i);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			len += snprintf(page + len, PAGE_SIZE - len, " %u",
+					rowd->row_queues[i].disp_lat[j]);
+		len += snprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t row_dispatch_latency_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		memset(rowd->row_queues[i].disp_lat, 0,
+		       sizeof(rowd->row_queues[i].disp_lat));
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -750,6 +954,9 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(read_idle_adaptive),
+	ROW_ATTR(queue_stats),
+	ROW_ATTR(dispatch_latency),
 	__ATTR_NULL
 };
 
@@ -1,23 +1,29 @@
 /*
-* Simple IO scheduler
-* Based on Noop, Deadline and V(R) IO schedulers.
-*
-* Copyright (C) 2012 Miguel Boton <mboton@gmail.com>
-*
-*
-* This algorithm does not do any kind of sorting, as it is aimed for
-* aleatory access devices, but it does some basic merging. We try to
-* keep minimum overhead to achieve low latency.
-*
-* Asynchronous and synchronous requests are not treated separately, but
-* we relay on deadlines to ensure fairness.
-*
-*/
+ * Simple IO scheduler
+ * Based on Noop, Deadline and V(R) IO schedulers.
+ *
+ * Copyright (C) 2012 Miguel Boton <mboton@gmail.com>
+ *
+ *
+ * This algorithm is aimed for aleatory access devices, so it only sorts
+ * requests by sector to merge them and to dispatch a batch of sequential
+ * requests in order. We try to keep minimum overhead to achieve low
+ * latency.
+ *
+ * Asynchronous and synchronous requests are not treated separately, but
+ * we relay on deadlines to ensure fairness. Optionally, sync readers of
+ * different processes take turns, so that one process streaming reads
+ * cannot delay the reads of all the others up to their deadline.
+ *
+ */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/iocontext.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
 #include <linux/version.h>
 
 enum { ASYNC, SYNC };
@@ -31,285 +37,507 @@ static const int async_write_expire = 16 * HZ; /* ditto for async, these limits
 
 static const int writes_starved = 1; /* max times reads can starve a write */
 static const int fifo_batch = 1; /* # of sequential requests treated as one
-by the above parameters. For throughput. */
+		by the above parameters. For throughput. */
+
+static const int front_merges = 1; /* look up front merges in the sort tree */
+static const int fair_readers = 0; /* sync readers take turns per process */
+static const int fair_quantum = 4; /* # of reads of a process per turn */
 
 /* Elevator data */
 struct sio_data {
-/* Request queues */
-struct list_head fifo_list[2][2];
-
-/* Attributes */
-unsigned int batched;
-unsigned int starved;
+	/* Request queues */
+	struct list_head fifo_list[2][2];
+
+	/* Sector sorted requests, for merging and batches */
+	struct rb_root sort_list[2];
+	struct request *next_rq;
+
+	/* Processes with sync reads queued, in turn order */
+	struct list_head rr_list;
+
+	/* Attributes */
+	unsigned int batched;
+	unsigned int starved;
+
+	/* Settings */
+	int fifo_expire[2][2];
+	int fifo_batch;
+	int writes_starved;
+	int front_merges;
+	int fair_readers;
+	int fair_quantum;
+};
 
-/* Settings */
-int fifo_expire[2][2];
-int fifo_batch;
-int writes_starved;
+/*
+ * The sync reads of one process, while fair_readers is set. They stay
+ * off fifo_list[SYNC][READ] and are picked in turn with the reads of the
+ * other processes. The structure lives while it has requests queued.
+ */
+struct sio_ioq {
+	struct io_context *ioc;
+	struct list_head fifo;
+	struct list_head rr;
+	unsigned int served;
 };
 
-static void
-sio_merged_requests(struct request_queue *q, struct request *rq,
-struct request *next)
+#define RQ_IOC(rq)	((struct io_context *) (rq)->elevator_private[0])
+#define RQ_IOQ(rq)	((struct sio_ioq *) (rq)->elevator_private[1])
+
+static inline struct rb_root *
+sio_rb_root(struct sio_data *sd, struct request *rq)
 {
-/*
-* If next expires before rq, assign its expire time to rq
-* and move into next position (next will be deleted) in fifo.
-*/
-if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
-if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
-list_move(&rq->queuelist, &next->queuelist);
-rq_set_fifo_time(rq, rq_fifo_time(next));
+	return &sd->sort_list[rq_data_dir(rq)];
 }
+
+static inline struct list_head *
+sio_rq_fifo(struct sio_data *sd, struct request *rq)
+{
+	if (RQ_IOQ(rq))
+		return &RQ_IOQ(rq)->fifo;
+
+	return &sd->fifo_list[rq_is_sync(rq)][rq_data_dir(rq)];
 }
 
-/* Delete next request */
-rq_fifo_clear(next);
+/*
+ * Get the request after `rq' in sector-sorted order
+ */
+static inline struct request *
+sio_latter_rq(struct request *rq)
+{
+	struct rb_node *node = rb_next(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
 }
 
-static void
-sio_add_request(struct request_queue *q, struct request *rq)
+static struct sio_ioq *
+sio_get_ioq(struct request_queue *q, struct sio_data *sd,
+	    struct io_context *ioc)
 {
-struct sio_data *sd = q->elevator->elevator_data;
-const int sync = rq_is_sync(rq);
-const int data_dir = rq_data_dir(rq);
+	struct sio_ioq *ioq;
 
-/*
-* Add request to the proper fifo list and set its
-* expire time.
-*/
-rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
-list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+	list_for_each_entry(ioq, &sd->rr_list, rr) {
+		if (ioq->ioc == ioc)
+			return ioq;
+	}
+
+	/* On failure the request just goes on the shared fifo */
+	ioq = kmalloc_node(sizeof(*ioq), GFP_ATOMIC, q->node);
+	if (!ioq)
+		return NULL;
+
+	ioq->ioc = ioc;
+	ioq->served = 0;
+	INIT_LIST_HEAD(&ioq->fifo);
+	list_add_tail(&ioq->rr, &sd->rr_list);
+
+	return ioq;
 }
 
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
-static int
-sio_queue_empty(struct request_queue *q)
+static void sio_dispatch_request(struct sio_data *sd, struct request *rq);
+
+static void
+sio_add_rq_rb(struct sio_data *sd, struct request *rq)
 {
-struct sio_data *sd = q->elevator->elevator_data;
+	struct rb_root *root = sio_rb_root(sd, rq);
+	struct request *__alias;
 
-/* Check if fifo lists are empty */
-return list_empty(&sd->fifo_list[SYNC][READ]) && list_empty(&sd->fifo_list[SYNC][WRITE]) &&
-list_empty(&sd->fifo_list[ASYNC][READ]) && list_empty(&sd->fifo_list[ASYNC][WRITE]);
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		sio_dispatch_request(sd, __alias);
 }
-#endif
 
-static struct request *
-sio_expired_request(struct sio_data *sd, int sync, int data_dir)
+static inline void
+sio_del_rq_rb(struct sio_data *sd, struct request *rq)
 {
-struct list_head *list = &sd->fifo_list[sync][data_dir];
-struct request *rq;
+	if (sd->next_rq == rq)
+		sd->next_rq = sio_latter_rq(rq);
 
-if (list_empty(list))
-return NULL;
+	elv_rb_del(sio_rb_root(sd, rq), rq);
+}
 
-/* Retrieve request */
-rq = rq_entry_fifo(list->next);
+/*
+ * Remove the request from the sort tree and from its fifo list.
+ */
+static void
+sio_remove_request(struct sio_data *sd, struct request *rq)
+{
+	struct sio_ioq *ioq = RQ_IOQ(rq);
 
-/* Request has expired */
-if (time_after(jiffies, rq_fifo_time(rq)))
-return rq;
+	rq_fifo_clear(rq);
+	sio_del_rq_rb(sd, rq);
 
-return NULL;
+	if (ioq && list_empty(&ioq->fifo)) {
+		list_del(&ioq->rr);
+		kfree(ioq);
+	}
+	rq->elevator_private[1] = NULL;
 }
 
-static struct request *
-sio_choose_expired_request(struct sio_data *sd)
+static int
+sio_merge(struct request_queue *q, struct request **req, struct bio *bio)
 {
-struct request *rq;
-
-/*
-* Check expired requests.
-* Asynchronous requests have priority over synchronous.
-* Write requests have priority over read.
-*/
-rq = sio_expired_request(sd, ASYNC, WRITE);
-if (rq)
-return rq;
-rq = sio_expired_request(sd, ASYNC, READ);
-if (rq)
-return rq;
-
-rq = sio_expired_request(sd, SYNC, WRITE);
-if (rq)
-return rq;
-rq = sio_expired_request(sd, SYNC, READ);
-if (rq)
-return rq;
-
-return NULL;
+	struct sio_data *sd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * Back merges are found by the elevator core, check for a
+	 * front merge.
+	 */
+	if (sd->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&sd->sort_list[bio_data_dir(bio)], sector);
+		if (__rq && elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
 }
 
-static struct request *
-sio_choose_request(struct sio_data *sd, int data_dir)
+static void
+sio_merged_request(struct request_queue *q, struct request *req, int type)
 {
-struct list_head *sync = sd->fifo_list[SYNC];
-struct list_head *async = sd->fifo_list[ASYNC];
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	/*
+	 * A front merge changes the start sector, so reposition
+	 * the request.
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(sio_rb_root(sd, req), req);
+		sio_add_rq_rb(sd, req);
+	}
+}
 
-/*
-* Retrieve request from available fifo list.
-* Synchronous requests have priority over asynchronous.
-* Read requests have priority over write.
-*/
-if (!list_empty(&sync[data_dir]))
-return rq_entry_fifo(sync[data_dir].next);
-if (!list_empty(&async[data_dir]))
-return rq_entry_fifo(async[data_dir].next);
-
-if (!list_empty(&sync[!data_dir]))
-return rq_entry_fifo(sync[!data_dir].next);
-if (!list_empty(&async[!data_dir]))
-return rq_entry_fifo(async[!data_dir].next);
-
-return NULL;
+static void
+sio_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	/*
+	 * If next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo.
+	 * If they sit on different fifo lists, rq keeps its own place.
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist) &&
+	    sio_rq_fifo(sd, rq) == sio_rq_fifo(sd, next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+		}
+	}
+
+	/* Delete next request */
+	sio_remove_request(sd, next);
 }
 
-static inline void
-sio_dispatch_request(struct sio_data *sd, struct request *rq)
+static void
+sio_add_request(struct request_queue *q, struct request *rq)
 {
-/*
-* Remove the request from the fifo list
-* and dispatch it.
-*/
-rq_fifo_clear(rq);
-elv_dispatch_add_tail(rq->q, rq);
-
-sd->batched++;
-
-if (rq_data_dir(rq))
-sd->starved = 0;
-else
-sd->starved++;
+	struct sio_data *sd = q->elevator->elevator_data;
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+
+	sio_add_rq_rb(sd, rq);
+
+	/* Sync reads of a known process wait for their turn */
+	rq->elevator_private[1] = NULL;
+	if (RQ_IOC(rq) && sync && data_dir == READ)
+		rq->elevator_private[1] = sio_get_ioq(q, sd, RQ_IOC(rq));
+
+	/*
+	 * Add request to the proper fifo list and set its
+	 * expire time.
+	 */
+	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
+	list_add_tail(&rq->queuelist, sio_rq_fifo(sd, rq));
 }
 
 static int
-sio_dispatch_requests(struct request_queue *q, int force)
+sio_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
 {
-struct sio_data *sd = q->elevator->elevator_data;
-struct request *rq = NULL;
-int data_dir = READ;
+	struct sio_data *sd = q->elevator->elevator_data;
 
-/*
-* Retrieve any expired request after a batch of
-* sequential requests.
-*/
-if (sd->batched > sd->fifo_batch) {
-sd->batched = 0;
-rq = sio_choose_expired_request(sd);
+	/* Only sync reads are scheduled per process */
+	if (sd->fair_readers && rq_is_sync(rq) && rq_data_dir(rq) == READ)
+		rq->elevator_private[0] = get_io_context(gfp_mask, q->node);
+
+	return 0;
 }
 
-/* Retrieve request */
-if (!rq) {
-if (sd->starved > sd->writes_starved)
-data_dir = WRITE;
+static void
+sio_put_request(struct request *rq)
+{
+	struct io_context *ioc = RQ_IOC(rq);
 
-rq = sio_choose_request(sd, data_dir);
-if (!rq)
-return 0;
+	if (ioc) {
+		rq->elevator_private[0] = NULL;
+		put_io_context(ioc);
+	}
 }
 
-/* Dispatch request */
-sio_dispatch_request(sd, rq);
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
+static int
+sio_queue_empty(struct request_queue *q)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
 
-return 1;
+	/* Check if fifo lists are empty */
+	return list_empty(&sd->fifo_list[SYNC][READ]) && list_empty(&sd->fifo_list[SYNC][WRITE]) &&
+	       list_empty(&sd->fifo_list[ASYNC][READ]) && list_empty(&sd->fifo_list[ASYNC][WRITE]) &&
+	       list_empty(&sd->rr_list);
 }
+#endif
 
 static struct request *
-sio_former_request(struct request_queue *q, struct request *rq)
+sio_expired_request(struct sio_data *sd, int sync, int data_dir)
+{
+	struct list_head *list = &sd->fifo_list[sync][data_dir];
+	struct request *rq = NULL, *__rq;
+	struct sio_ioq *ioq;
+
+	if (!list_empty(list))
+		rq = rq_entry_fifo(list->next);
+
+	/* The oldest sync read may wait for the turn of its process */
+	if (sync == SYNC && data_dir == READ) {
+		list_for_each_entry(ioq, &sd->rr_list, rr) {
+			__rq = rq_entry_fifo(ioq->fifo.next);
+			if (!rq || time_before(rq_fifo_time(__rq), rq_fifo_time(rq)))
+				rq = __rq;
+		}
+	}
+
+	/* Request has expired */
+	if (rq && time_after(jiffies, rq_fifo_time(rq)))
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+sio_choose_expired_request(struct sio_data *sd)
+{
+	struct request *rq;
+
+	/*
+	 * Check expired requests.
+	 * Asynchronous requests have priority over synchronous.
+	 * Write requests have priority over read.
+	 */
+	rq = sio_expired_request(sd, ASYNC, WRITE);
+	if (rq)
+		return rq;
+	rq = sio_expired_request(sd, ASYNC, READ);
+	if (rq)
+		return rq;
+
+	rq = sio_expired_request(sd, SYNC, WRITE);
+	if (rq)
+		return rq;
+	rq = sio_expired_request(sd, SYNC, READ);
+	if (rq)
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+sio_first_request(struct sio_data *sd, int sync, int data_dir)
 {
-struct sio_data *sd = q->elevator->elevator_data;
-const int sync = rq_is_sync(rq);
-const int data_dir = rq_data_dir(rq);
+	struct list_head *list = &sd->fifo_list[sync][data_dir];
+	struct sio_ioq *ioq;
 
-if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
-return NULL;
+	if (!list_empty(list))
+		return rq_entry_fifo(list->next);
 
-/* Return former request */
-return list_entry(rq->queuelist.prev, struct request, queuelist);
+	/* Then the process whose turn it is */
+	if (sync == SYNC && data_dir == READ && !list_empty(&sd->rr_list)) {
+		ioq = list_first_entry(&sd->rr_list, struct sio_ioq, rr);
+		return rq_entry_fifo(ioq->fifo.next);
+	}
+
+	return NULL;
 }
 
 static struct request *
-sio_latter_request(struct request_queue *q, struct request *rq)
+sio_choose_request(struct sio_data *sd, int data_dir)
 {
-struct sio_data *sd = q->elevator->elevator_data;
-const int sync = rq_is_sync(rq);
-const int data_dir = rq_data_dir(rq);
+	struct request *rq;
+
+	/*
+	 * Retrieve request from available fifo list.
+	 * Synchronous requests have priority over asynchronous.
+	 * Read requests have priority over write.
+	 */
+	rq = sio_first_request(sd, SYNC, data_dir);
+	if (rq)
+		return rq;
+	rq = sio_first_request(sd, ASYNC, data_dir);
+	if (rq)
+		return rq;
+
+	rq = sio_first_request(sd, SYNC, !data_dir);
+	if (rq)
+		return rq;
+	rq = sio_first_request(sd, ASYNC, !data_dir);
+	if (rq)
+		return rq;
+
+	return NULL;
+}
 
-if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
-return NULL;
+static void
+sio_dispatch_request(struct sio_data *sd, struct request *rq)
+{
+	struct sio_ioq *ioq = RQ_IOQ(rq);
+
+	/*
+	 * Pass the turn on once a process has had its quantum,
+	 * however its reads got picked.
+	 */
+	if (ioq && ++ioq->served >= sd->fair_quantum) {
+		ioq->served = 0;
+		list_move_tail(&ioq->rr, &sd->rr_list);
+	}
+
+	/*
+	 * Remove the request from the sort tree and fifo list
+	 * and dispatch it. The batch goes on with the next
+	 * request in sector order.
+	 */
+	sd->next_rq = sio_latter_rq(rq);
+	sio_remove_request(sd, rq);
+	elv_dispatch_add_tail(rq->q, rq);
+
+	sd->batched++;
+
+	if (rq_data_dir(rq))
+		sd->starved = 0;
+	else
+		sd->starved++;
+}
 
-/* Return latter request */
-return list_entry(rq->queuelist.next, struct request, queuelist);
+static int
+sio_dispatch_requests(struct request_queue *q, int force)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	struct request *rq = NULL;
+	int data_dir = READ;
+
+	/*
+	 * Retrieve any expired request after a batch of
+	 * sequential requests.
+	 */
+	if (sd->batched > sd->fifo_batch) {
+		sd->batched = 0;
+		sd->next_rq = NULL;
+		rq = sio_choose_expired_request(sd);
+	}
+
+	/* Carry on with the batch */
+	if (!rq)
+		rq = sd->next_rq;
+
+	/* Retrieve request */
+	if (!rq) {
+		if (sd->starved > sd->writes_starved)
+			data_dir = WRITE;
+
+		rq = sio_choose_request(sd, data_dir);
+		if (!rq)
+			return 0;
+	}
+
+	/* Dispatch request */
+	sio_dispatch_request(sd, rq);
+
+	return 1;
 }
 
 static void *
 sio_init_queue(struct request_queue *q)
 {
-struct sio_data *sd;
-
-/* Allocate structure */
-sd = kmalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
-if (!sd)
-return NULL;
-
-/* Initialize fifo lists */
-INIT_LIST_HEAD(&sd->fifo_list[SYNC][READ]);
-INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
-INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
-INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
-
-/* Initialize data */
-sd->batched = 0;
-sd->fifo_expire[SYNC][READ] = sync_read_expire;
-sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
-sd->fifo_expire[ASYNC][READ] = async_read_expire;
-sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
-sd->fifo_batch = fifo_batch;
-
-return sd;
+	struct sio_data *sd;
+
+	/* Allocate structure */
+	sd = kzalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
+	if (!sd)
+		return NULL;
+
+	/* Initialize fifo lists */
+	INIT_LIST_HEAD(&sd->fifo_list[SYNC][READ]);
+	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
+	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
+	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	INIT_LIST_HEAD(&sd->rr_list);
+
+	/* Initialize sort trees */
+	sd->sort_list[READ] = RB_ROOT;
+	sd->sort_list[WRITE] = RB_ROOT;
+
+	/* Initialize data */
+	sd->batched = 0;
+	sd->fifo_expire[SYNC][READ] = sync_read_expire;
+	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
+	sd->fifo_expire[ASYNC][READ] = async_read_expire;
+	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
+	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->front_merges = front_merges;
+	sd->fair_readers = fair_readers;
+	sd->fair_quantum = fair_quantum;
+
+	return sd;
 }
 
 static void
 sio_exit_queue(struct elevator_queue *e)
 {
-struct sio_data *sd = e->elevator_data;
+	struct sio_data *sd = e->elevator_data;
 
-BUG_ON(!list_empty(&sd->fifo_list[SYNC][READ]));
-BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
-BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
-BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+	BUG_ON(!list_empty(&sd->fifo_list[SYNC][READ]));
+	BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
+	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
+	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+	BUG_ON(!list_empty(&sd->rr_list));
 
-/* Free structure */
-kfree(sd);
+	/* Free structure */
+	kfree(sd);
 }
 
 /*
-* sysfs code
-*/
+ * sysfs code
+ */
 
 static ssize_t
 sio_var_show(int var, char *page)
 {
-return sprintf(page, "%d\n", var);
+	return sprintf(page, "%d\n", var);
 }
 
 static ssize_t
 sio_var_store(int *var, const char *page, size_t count)
 {
-char *p = (char *) page;
+	char *p = (char *) page;
 
-*var = simple_strtol(p, &p, 10);
-return count;
+	*var = simple_strtol(p, &p, 10);
+	return count;
 }
 
 #define SHOW_FUNCTION(__FUNC, __VAR, __CONV) \
 static ssize_t __FUNC(struct elevator_queue *e, char *page) \
 { \
-struct sio_data *sd = e->elevator_data; \
-int __data = __VAR; \
-if (__CONV) \
-__data = jiffies_to_msecs(__data); \
-return sio_var_show(__data, (page)); \
+	struct sio_data *sd = e->elevator_data; \
+	int __data = __VAR; \
+	if (__CONV) \
+		__data = jiffies_to_msecs(__data); \
+	return sio_var_show(__data, (page)); \
 }
 SHOW_FUNCTION(sio_sync_read_expire_show, sd->fifo_expire[SYNC][READ], 1);
 SHOW_FUNCTION(sio_sync_write_expire_show, sd->fifo_expire[SYNC][WRITE], 1);
@@ -317,23 +545,26 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_front_merges_show, sd->front_merges, 0);
+SHOW_FUNCTION(sio_fair_readers_show, sd->fair_readers, 0);
+SHOW_FUNCTION(sio_fair_quantum_show, sd->fair_quantum, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV) \
 static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count) \
 { \
-struct sio_data *sd = e->elevator_data; \
-int __data; \
-int ret = sio_var_store(&__data, (page), count); \
-if (__data < (MIN)) \
-__data = (MIN); \
-else if (__data > (MAX)) \
-__data = (MAX); \
-if (__CONV) \
-*(__PTR) = msecs_to_jiffies(__data); \
-else \
-*(__PTR) = __data; \
-return ret; \
+	struct sio_data *sd = e->elevator_data; \
+	int __data; \
+	int ret = sio_var_store(&__data, (page), count); \
+	if (__data < (MIN)) \
+		__data = (MIN); \
+	else if (__data > (MAX)) \
+		__data = (MAX); \
+	if (__CONV) \
+		*(__PTR) = msecs_to_jiffies(__data); \
+	else \
+		*(__PTR) = __data; \
+	return ret; \
 }
 STORE_FUNCTION(sio_sync_read_expire_store, &sd->fifo_expire[SYNC][READ], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_sync_write_expire_store, &sd->fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
@@ -341,53 +572,63 @@ STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, IN
 STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_front_merges_store, &sd->front_merges, 0, 1, 0);
+STORE_FUNCTION(sio_fair_readers_store, &sd->fair_readers, 0, 1, 0);
+STORE_FUNCTION(sio_fair_quantum_store, &sd->fair_quantum, 1, INT_MAX, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
-__ATTR(name, S_IRUGO|S_IWUSR, sio_##name##_show, \
-sio_##name##_store)
+	__ATTR(name, S_IRUGO|S_IWUSR, sio_##name##_show, \
+	       sio_##name##_store)
 
 static struct elv_fs_entry sio_attrs[] = {
-DD_ATTR(sync_read_expire),
-DD_ATTR(sync_write_expire),
-DD_ATTR(async_read_expire),
-DD_ATTR(async_write_expire),
-DD_ATTR(fifo_batch),
-DD_ATTR(writes_starved),
-__ATTR_NULL
+	DD_ATTR(sync_read_expire),
+	DD_ATTR(sync_write_expire),
+	DD_ATTR(async_read_expire),
+	DD_ATTR(async_write_expire),
+	DD_ATTR(fifo_batch),
+	DD_ATTR(writes_starved),
+	DD_ATTR(front_merges),
+	DD_ATTR(fair_readers),
+	DD_ATTR(fair_quantum),
+	__ATTR_NULL
 };
 
 static struct elevator_type iosched_sio = {
-.ops = {
-.elevator_merge_req_fn = sio_merged_requests,
-.elevator_dispatch_fn = sio_dispatch_requests,
-.elevator_add_req_fn = sio_add_request,
+	.ops = {
+		.elevator_merge_fn = sio_merge,
+		.elevator_merged_fn = sio_merged_request,
+		.elevator_merge_req_fn = sio_merged_requests,
+		.elevator_dispatch_fn = sio_dispatch_requests,
+		.elevator_add_req_fn = sio_add_request,
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
-.elevator_queue_empty_fn = sio_queue_empty,
+		.elevator_queue_empty_fn = sio_queue_empty,
 #endif
-.elevator_former_req_fn = sio_former_request,
-.elevator_latter_req_fn = sio_latter_request,
-.elevator_init_fn = sio_init_queue,
-.elevator_exit_fn = sio_exit_queue,
-},
-
-.elevator_attrs = sio_attrs,
-.elevator_name = "sio",
-.elevator_owner = THIS_MODULE,
+		.elevator_former_req_fn = elv_rb_former_request,
+		.elevator_latter_req_fn = elv_rb_latter_request,
+		.elevator_set_req_fn = sio_set_request,
+		.elevator_put_req_fn = sio_put_request,
+		.elevator_init_fn = sio_init_queue,
+		.elevator_exit_fn = sio_exit_queue,
+	},
+
+	.elevator_attrs = sio_attrs,
+	.elevator_name = "sio",
+	.elevator_owner = THIS_MODULE,
 };
 
 static int __init sio_init(void)
 {
-/* Register elevator */
-elv_register(&iosched_sio);
+	/* Register elevator */
+	elv_register(&iosched_sio);
 
-return 0;
+	return 0;
 }
 
 static void __exit sio_exit(void)
 {
-/* Unregister elevator */
-elv_unregister(&iosched_sio);
+	/* Unregister elevator */
+	elv_unregister(&iosched_sio);
 }
 
 module_init(sio_init);
@@ -396,4 +637,4 @@ module_exit(sio_exit);
 MODULE_AUTHOR("Miguel Boton");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Simple IO scheduler");
-MODULE_VERSION("0.2");
+MODULE_VERSION("0.3");
@@ -0,0 +1,342 @@
+/*
+ * RAM backed block device with flash-like service times.
+ *
+ * Unlike brd, which hands bios straight to its make_request function,
+ * flashram takes requests through a request_fn so that the I/O scheduler
+ * of the queue is in the path. Every request is then held for a modelled
+ * service time before it completes: a fixed latency plus a cost per KiB,
+ * with writes slower than reads and an extra penalty for a write that does
+ * not follow on from the previous one, roughly like eMMC or SD flash. Only
+ * queue_depth requests are outstanding at a time, so the elevator always
+ * has a backlog to choose from.
+ *
+ * It is meant for comparing I/O schedulers with tools/iosched-bench and
+ * has no use for storing real data.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+
+static int size_mb = 64;
+module_param(size_mb, int, 0444);
+MODULE_PARM_DESC(size_mb, "Size of the device in MiB");
+
+static int queue_depth = 2;
+module_param(queue_depth, int, 0444);
+MODULE_PARM_DESC(queue_depth, "Requests taken off the queue at a time");
+
+static unsigned int read_us = 100;
+module_param(read_us, uint, 0644);
+MODULE_PARM_DESC(read_us, "Fixed latency of a read request in usecs");
+
+static unsigned int write_us = 400;
+module_param(write_us, uint, 0644);
+MODULE_PARM_DESC(write_us, "Fixed latency of a write request in usecs");
+
+static unsigned int read_kb_us = 10;
+module_param(read_kb_us, uint, 0644);
+MODULE_PARM_DESC(read_kb_us, "Read transfer cost per KiB in usecs");
+
+static unsigned int write_kb_us = 40;
+module_param(write_kb_us, uint, 0644);
+MODULE_PARM_DESC(write_kb_us, "Write transfer cost per KiB in usecs");
+
+static unsigned int random_write_us = 1000;
+module_param(random_write_us, uint, 0644);
+MODULE_PARM_DESC(random_write_us,
+		 "Extra latency of a write that is not sequential in usecs");
+
+struct flashram_device {
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+	int			major;
+
+	/*
+	 * The queue lock also protects the list of requests fetched from
+	 * the elevator and not yet completed.
+	 */
+	spinlock_t		lock;
+	struct list_head	fetched;
+	int			nr_fetched;
+
+	/* only touched by the service thread */
+	struct task_struct	*thread;
+	wait_queue_head_t	wait;
+	sector_t		next_write;
+
+	struct page		**pages;
+	unsigned long		nr_pages;
+};
+
+static struct flashram_device *flashram;
+
+/*
+ * Copies len bytes between the device at sector and the bvec page,
+ * allocating backing pages on write. Reads of pages that were never
+ * written return zeroes.
+ */
+static int flashram_copy(struct flashram_device *fr, struct page *page,
+			 unsigned int off, unsigned int len, sector_t sector,
+			 int rw)
+{
+	while (len) {
+		unsigned long idx = sector >> PAGE_SECTORS_SHIFT;
+		unsigned int doff = (sector << SECTOR_SHIFT) & ~PAGE_MASK;
+		unsigned int n = min_t(unsigned int, len, PAGE_SIZE - doff);
+		struct page *dpage = fr->pages[idx];
+		void *src, *dst;
+
+		if (rw == WRITE && !dpage) {
+			dpage = alloc_page(GFP_NOIO | __GFP_HIGHMEM |
+					   __GFP_ZERO);
+			if (!dpage)
+				return -ENOMEM;
+			fr->pages[idx] = dpage;
+		}
+
+		dst = kmap_atomic(page, KM_USER0);
+		if (rw == READ) {
+			if (dpage) {
+				src = kmap_atomic(dpage, KM_USER1);
+				memcpy(dst + off, src + doff, n);
+				kunmap_atomic(src, KM_USER1);
+			} else
+				memset(dst + off, 0, n);
+		} else {
+			src = kmap_atomic(dpage, KM_USER1);
+			memcpy(src + doff, dst + off, n);
+			kunmap_atomic(src, KM_USER1);
+		}
+		kunmap_atomic(dst, KM_USER0);
+
+		off += n;
+		len -= n;
+		sector += n >> SECTOR_SHIFT;
+	}
+
+	return 0;
+}
+
+static int flashram_transfer(struct flashram_device *fr, struct request *rq)
+{
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	sector_t sector = blk_rq_pos(rq);
+	int rw = rq_data_dir(rq);
+	int err;
+
+	if (sector + blk_rq_sectors(rq) > get_capacity(fr->disk))
+		return -EIO;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		err = flashram_copy(fr, bvec->bv_page, bvec->bv_offset,
+				    bvec->bv_len, sector, rw);
+		if (err)
+			return err;
+		sector += bvec->bv_len >> SECTOR_SHIFT;
+	}
+
+	return 0;
+}
+
+static unsigned int flashram_service_us(struct flashram_device *fr,
+					struct request *rq)
+{
+	unsigned int kb = blk_rq_bytes(rq) >> 10;
+	unsigned int us;
+
+	if (rq_data_dir(rq) == READ)
+		return read_us + kb * read_kb_us;
+
+	us = write_us + kb * write_kb_us;
+	if (blk_rq_pos(rq) != fr->next_write)
+		us += random_write_us;
+	fr->next_write = blk_rq_pos(rq) + blk_rq_sectors(rq);
+	return us;
+}
+
+static void flashram_request(struct request_queue *q)
+{
+	struct flashram_device *fr = q->queuedata;
+	struct request *rq;
+
+	while (fr->nr_fetched < queue_depth) {
+		rq = blk_fetch_request(q);
+		if (!rq)
+			break;
+		if (rq->cmd_type != REQ_TYPE_FS) {
+			__blk_end_request_all(rq, -EIO);
+			continue;
+		}
+		list_add_tail(&rq->queuelist, &fr->fetched);
+		fr->nr_fetched++;
+	}
+
+	if (fr->nr_fetched)
+		wake_up(&fr->wait);
+}
+
+static struct request *flashram_next(struct flashram_device *fr)
+{
+	struct request *rq = NULL;
+
+	spin_lock_irq(&fr->lock);
+	if (!list_empty(&fr->fetched)) {
+		rq = list_first_entry(&fr->fetched, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+	}
+	spin_unlock_irq(&fr->lock);
+
+	return rq;
+}
+
+static int flashram_thread(void *data)
+{
+	struct flashram_device *fr = data;
+	struct request *rq;
+
+	for (;;) {
+		ktime_t deadline;
+		s64 left;
+		int err;
+
+		/* interruptible, so an idle device does not add to the load */
+		wait_event_interruptible(fr->wait,
+					 (rq = flashram_next(fr)) ||
+					 kthread_should_stop());
+		if (!rq) {
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+
+		deadline = ktime_add_us(ktime_get(),
+					flashram_service_us(fr, rq));
+		err = flashram_transfer(fr, rq);
+		left = ktime_us_delta(deadline, ktime_get());
+		if (left > 0)
+			usleep_range(left, left);
+
+		spin_lock_irq(&fr->lock);
+		__blk_end_request_all(rq, err);
+		fr->nr_fetched--;
+		flashram_request(fr->queue);
+		spin_unlock_irq(&fr->lock);
+	}
+
+	return 0;
+}
+
+static const struct block_device_operations flashram_fops = {
+	.owner =		THIS_MODULE,
+};
+
+static void flashram_free_pages(struct flashram_device *fr)
+{
+	unsigned long i;
+
+	for (i = 0; i < fr->nr_pages; i++)
+		if (fr->pages[i])
+			__free_page(fr->pages[i]);
+	vfree(fr->pages);
+}
+
+static int __init flashram_init(void)
+{
+	struct flashram_device *fr;
+	int err = -ENOMEM;
+
+	if (size_mb <= 0 || queue_depth <= 0)
+		return -EINVAL;
+
+	fr = kzalloc(sizeof(*fr), GFP_KERNEL);
+	if (!fr)
+		return -ENOMEM;
+	spin_lock_init(&fr->lock);
+	INIT_LIST_HEAD(&fr->fetched);
+	init_waitqueue_head(&fr->wait);
+
+	fr->nr_pages = (unsigned long)size_mb << (20 - PAGE_SHIFT);
+	fr->pages = vzalloc(fr->nr_pages * sizeof(struct page *));
+	if (!fr->pages)
+		goto out_free;
+
+	fr->major = register_blkdev(0, "flashram");
+	if (fr->major < 0) {
+		err = fr->major;
+		goto out_pages;
+	}
+
+	fr->queue = blk_init_queue(flashram_request, &fr->lock);
+	if (!fr->queue)
+		goto out_unregister;
+	fr->queue->queuedata = fr;
+	blk_queue_max_hw_sectors(fr->queue, 1024);
+	blk_queue_physical_block_size(fr->queue, PAGE_SIZE);
+
+	fr->disk = alloc_disk(1);
+	if (!fr->disk)
+		goto out_queue;
+	fr->disk->major = fr->major;
+	fr->disk->first_minor = 0;
+	fr->disk->fops = &flashram_fops;
+	fr->disk->private_data = fr;
+	fr->disk->queue = fr->queue;
+	strcpy(fr->disk->disk_name, "flashram0");
+	set_capacity(fr->disk, (sector_t)size_mb << (20 - SECTOR_SHIFT));
+
+	fr->thread = kthread_run(flashram_thread, fr, "flashram");
+	if (IS_ERR(fr->thread)) {
+		err = PTR_ERR(fr->thread);
+		goto out_disk;
+	}
+
+	flashram = fr;
+	add_disk(fr->disk);
+	printk(KERN_INFO "flashram: %d MiB, read %u+%u/KiB us, "
+	       "write %u+%u/KiB us\n", size_mb, read_us, read_kb_us,
+	       write_us, write_kb_us);
+	return 0;
+
+out_disk:
+	put_disk(fr->disk);
+out_queue:
+	blk_cleanup_queue(fr->queue);
+out_unregister:
+	unregister_blkdev(fr->major, "flashram");
+out_pages:
+	vfree(fr->pages);
+out_free:
+	kfree(fr);
+	return err;
+}
+
+static void __exit flashram_exit(void)
+{
+	struct flashram_device *fr = flashram;
+
+	del_gendisk(fr->disk);
+	kthread_stop(fr->thread);
+	blk_cleanup_queue(fr->queue);
+	put_disk(fr->disk);
+	unregister_blkdev(fr->major, "flashram");
+	flashram_free_pages(fr);
+	kfree(fr);
+}
+
+module_init(flashram_init);
+module_exit(flashram_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RAM block device with flash-like service times");
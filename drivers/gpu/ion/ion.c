@@ -20,6 +20,7 @@
 #include <linux/fs.h>
 #include <linux/anon_inodes.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -206,6 +207,70 @@ static struct ion_iommu_map *ion_iommu_lookup(struct ion_buffer *buffer,
 	return NULL;
 }
 
+/*
+ * Heaps with ION_HEAP_FLAG_DEFER_FREE hand buffers whose last reference is
+ * gone to their free_task. The thread scrubs the ones it can map and keeps
+ * them in the recycle cache of the heap, where an allocation of the same
+ * size and cacheability takes them without going through the heap.
+ * Buffers leave the cache when they were not reused for a while, to make
+ * room for more recently freed ones, or when the shrinker asks for memory.
+ */
+#define ION_RECYCLE_MAX		(16 << 20)
+#define ION_RECYCLE_TIMEOUT	HZ
+
+/* heaps with a recycle cache, for the shrinker */
+static LIST_HEAD(ion_recycle_heaps);
+static DEFINE_MUTEX(ion_recycle_heaps_lock);
+
+static int ion_recycle_cmp(size_t size, bool cached, struct ion_buffer *buffer)
+{
+	bool buffer_cached = ION_IS_CACHED(buffer->alloc_flags);
+
+	if (size != buffer->size)
+		return size < buffer->size ? -1 : 1;
+	if (cached != buffer_cached)
+		return cached < buffer_cached ? -1 : 1;
+	return 0;
+}
+
+/* takes a buffer of the right size out of the recycle cache, if any */
+static struct ion_buffer *ion_recycle_get(struct ion_heap *heap,
+					  unsigned long len,
+					  unsigned long align,
+					  unsigned long flags)
+{
+	struct ion_buffer *buffer = NULL;
+	struct rb_node *n;
+
+	if (!(heap->flags & ION_HEAP_FLAG_DEFER_FREE) || align > PAGE_SIZE)
+		return NULL;
+
+	spin_lock(&heap->free_lock);
+	n = heap->recycle.rb_node;
+	while (n) {
+		struct ion_buffer *entry = rb_entry(n, struct ion_buffer, node);
+		int cmp = ion_recycle_cmp(len, ION_IS_CACHED(flags), entry);
+
+		if (cmp < 0) {
+			n = n->rb_left;
+		} else if (cmp > 0) {
+			n = n->rb_right;
+		} else {
+			buffer = entry;
+			break;
+		}
+	}
+	if (buffer) {
+		rb_erase(&buffer->node, &heap->recycle);
+		list_del(&buffer->free_list);
+		heap->recycle_size -= buffer->size;
+		heap->recycle_hits++;
+	}
+	spin_unlock(&heap->free_lock);
+
+	return buffer;
+}
+
 /* this function should only be called while dev->lock is held */
 static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 				     struct ion_device *dev,
@@ -216,6 +281,14 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	struct ion_buffer *buffer;
 	int ret;
 
+	buffer = ion_recycle_get(heap, len, align, flags);
+	if (buffer) {
+		kref_init(&buffer->ref);
+		buffer->alloc_flags = flags;
+		ion_buffer_add(dev, buffer);
+		return buffer;
+	}
+
 	buffer = kzalloc(sizeof(struct ion_buffer), GFP_KERNEL);
 	if (!buffer)
 		return ERR_PTR(-ENOMEM);
@@ -230,21 +303,265 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	}
 	buffer->dev = dev;
 	buffer->size = len;
+	buffer->alloc_flags = flags;
 	mutex_init(&buffer->lock);
 	ion_buffer_add(dev, buffer);
 	return buffer;
 }
 
+static void ion_buffer_release(struct ion_buffer *buffer)
+{
+	buffer->heap->ops->free(buffer);
+	kfree(buffer);
+}
+
 static void ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
 	struct ion_device *dev = buffer->dev;
+	struct ion_heap *heap = buffer->heap;
 
-	buffer->heap->ops->free(buffer);
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
 	mutex_unlock(&dev->lock);
-	kfree(buffer);
+
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		spin_lock(&heap->free_lock);
+		list_add_tail(&buffer->free_list, &heap->free_list);
+		heap->free_list_size += buffer->size;
+		spin_unlock(&heap->free_lock);
+		wake_up(&heap->free_wait);
+		return;
+	}
+	ion_buffer_release(buffer);
+}
+
+static bool ion_buffer_recyclable(struct ion_heap *heap,
+				  struct ion_buffer *buffer)
+{
+	if (buffer->size > heap->recycle_max)
+		return false;
+	if (!heap->ops->map_kernel || !heap->ops->unmap_kernel)
+		return false;
+	return !buffer->kmap_cnt && !buffer->dmap_cnt && !buffer->umap_cnt &&
+		!buffer->iommu_map_cnt && RB_EMPTY_ROOT(&buffer->iommu_maps);
+}
+
+/* clears the buffer for its next user, returns false if it can't */
+static bool ion_buffer_scrub(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	void *vaddr;
+
+	vaddr = heap->ops->map_kernel(heap, buffer, buffer->alloc_flags);
+	if (IS_ERR_OR_NULL(vaddr))
+		return false;
+	memset(vaddr, 0, buffer->size);
+	buffer->vaddr = vaddr;
+	heap->ops->unmap_kernel(heap, buffer);
+	buffer->vaddr = NULL;
+	buffer->flags = 0;
+	buffer->marked = 0;
+	return true;
+}
+
+/*
+ * Frees the least recently freed buffers of the recycle cache while it is
+ * over its limit, the shrinker wants memory back or they timed out, or all
+ * of them.
+ */
+static void ion_recycle_trim(struct ion_heap *heap, bool all)
+{
+	for (;;) {
+		struct ion_buffer *buffer = NULL;
+
+		spin_lock(&heap->free_lock);
+		if (!list_empty(&heap->recycle_lru)) {
+			buffer = list_first_entry(&heap->recycle_lru,
+						  struct ion_buffer, free_list);
+			if (!all && !heap->recycle_shrink &&
+			    heap->recycle_size <= heap->recycle_max &&
+			    time_before(jiffies, buffer->free_time +
+					ION_RECYCLE_TIMEOUT))
+				buffer = NULL;
+		}
+		if (buffer) {
+			rb_erase(&buffer->node, &heap->recycle);
+			list_del(&buffer->free_list);
+			heap->recycle_size -= buffer->size;
+			heap->recycle_shrink -= min(heap->recycle_shrink,
+						    buffer->size);
+		} else {
+			heap->recycle_shrink = 0;
+		}
+		spin_unlock(&heap->free_lock);
+
+		if (!buffer)
+			break;
+		ion_buffer_release(buffer);
+	}
+}
+
+static void ion_recycle_put(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	struct rb_node **p = &heap->recycle.rb_node;
+	struct rb_node *parent = NULL;
+	bool cached = ION_IS_CACHED(buffer->alloc_flags);
+
+	spin_lock(&heap->free_lock);
+	while (*p) {
+		struct ion_buffer *entry;
+
+		parent = *p;
+		entry = rb_entry(parent, struct ion_buffer, node);
+		if (ion_recycle_cmp(buffer->size, cached, entry) < 0)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&buffer->node, parent, p);
+	rb_insert_color(&buffer->node, &heap->recycle);
+	buffer->free_time = jiffies;
+	list_add_tail(&buffer->free_list, &heap->recycle_lru);
+	heap->recycle_size += buffer->size;
+	spin_unlock(&heap->free_lock);
+}
+
+static void ion_heap_drain_free_list(struct ion_heap *heap, bool recycle)
+{
+	for (;;) {
+		struct ion_buffer *buffer;
+
+		spin_lock(&heap->free_lock);
+		if (list_empty(&heap->free_list)) {
+			spin_unlock(&heap->free_lock);
+			break;
+		}
+		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
+					  free_list);
+		list_del(&buffer->free_list);
+		heap->free_list_size -= buffer->size;
+		spin_unlock(&heap->free_lock);
+
+		if (recycle && ion_buffer_recyclable(heap, buffer) &&
+		    ion_buffer_scrub(heap, buffer))
+			ion_recycle_put(heap, buffer);
+		else
+			ion_buffer_release(buffer);
+	}
+}
+
+static int ion_heap_free_thread(void *data)
+{
+	struct ion_heap *heap = data;
+
+	while (!kthread_should_stop()) {
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+
+		/* wake up now and then to let idle buffers go */
+		if (!list_empty(&heap->recycle_lru))
+			timeout = ION_RECYCLE_TIMEOUT;
+		wait_event_interruptible_timeout(heap->free_wait,
+					!list_empty(&heap->free_list) ||
+					heap->recycle_shrink ||
+					kthread_should_stop(), timeout);
+
+		ion_heap_drain_free_list(heap, true);
+		ion_recycle_trim(heap, false);
+	}
+
+	return 0;
+}
+
+/*
+ * Asks the free threads to give back nr_to_scan pages of their recycle
+ * caches. The buffers are not freed here: reclaim may have been entered
+ * from the allocate op of the very heap, under its own locks.
+ */
+static int ion_recycle_shrink(struct shrinker *shrinker,
+			      struct shrink_control *sc)
+{
+	struct ion_heap *heap;
+	int nr_to_scan = sc->nr_to_scan;
+	int left = 0;
+
+	/* a heap is being added or removed, try again later */
+	if (!mutex_trylock(&ion_recycle_heaps_lock))
+		return -1;
+
+	list_for_each_entry(heap, &ion_recycle_heaps, recycle_node) {
+		size_t cached, bytes = 0;
+
+		spin_lock(&heap->free_lock);
+		cached = heap->recycle_size -
+			min(heap->recycle_shrink, heap->recycle_size);
+		if (nr_to_scan > 0 && cached) {
+			bytes = min_t(size_t, cached,
+				      (size_t)nr_to_scan << PAGE_SHIFT);
+			heap->recycle_shrink += bytes;
+			cached -= bytes;
+		}
+		spin_unlock(&heap->free_lock);
+
+		if (bytes) {
+			nr_to_scan -= DIV_ROUND_UP(bytes, PAGE_SIZE);
+			wake_up(&heap->free_wait);
+		}
+		left += cached >> PAGE_SHIFT;
+	}
+	mutex_unlock(&ion_recycle_heaps_lock);
+
+	return left;
+}
+
+static struct shrinker ion_recycle_shrinker = {
+	.shrink = ion_recycle_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static void ion_heap_deferred_free_init(struct ion_heap *heap)
+{
+	spin_lock_init(&heap->free_lock);
+	INIT_LIST_HEAD(&heap->free_list);
+	heap->recycle = RB_ROOT;
+	INIT_LIST_HEAD(&heap->recycle_lru);
+	init_waitqueue_head(&heap->free_wait);
+
+	if (!(heap->flags & ION_HEAP_FLAG_DEFER_FREE))
+		return;
+
+	heap->recycle_max = ION_RECYCLE_MAX;
+	heap->free_task = kthread_run(ion_heap_free_thread, heap,
+				      "ion_%s", heap->name);
+	if (IS_ERR(heap->free_task)) {
+		pr_err("%s: could not start the free thread of heap %s\n",
+		       __func__, heap->name);
+		heap->free_task = NULL;
+		heap->flags &= ~ION_HEAP_FLAG_DEFER_FREE;
+		return;
+	}
+
+	mutex_lock(&ion_recycle_heaps_lock);
+	if (list_empty(&ion_recycle_heaps))
+		register_shrinker(&ion_recycle_shrinker);
+	list_add_tail(&heap->recycle_node, &ion_recycle_heaps);
+	mutex_unlock(&ion_recycle_heaps_lock);
+}
+
+void ion_heap_deferred_free_stop(struct ion_heap *heap)
+{
+	if (!heap->free_task)
+		return;
+
+	mutex_lock(&ion_recycle_heaps_lock);
+	list_del(&heap->recycle_node);
+	if (list_empty(&ion_recycle_heaps))
+		unregister_shrinker(&ion_recycle_shrinker);
+	mutex_unlock(&ion_recycle_heaps_lock);
+
+	kthread_stop(heap->free_task);
+	heap->free_task = NULL;
+	ion_heap_drain_free_list(heap, false);
+	ion_recycle_trim(heap, true);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -1622,6 +1939,14 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	}
 	if (heap->ops->print_debug)
 		heap->ops->print_debug(heap, s);
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		spin_lock(&heap->free_lock);
+		seq_printf(s, "deferred free: %zu bytes pending, recycle cache: "
+			   "%zu of %u bytes, %lu hits\n",
+			   heap->free_list_size, heap->recycle_size,
+			   heap->recycle_max, heap->recycle_hits);
+		spin_unlock(&heap->free_lock);
+	}
 	return 0;
 }
 
@@ -1662,8 +1987,16 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 
 	rb_link_node(&heap->node, parent, p);
 	rb_insert_color(&heap->node, &dev->heaps);
+	ion_heap_deferred_free_init(heap);
 	debugfs_create_file(heap->name, 0664, dev->debug_root, heap,
 			    &debug_heap_fops);
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "%s_recycle_max", heap->name);
+		debugfs_create_u32(name, 0664, dev->debug_root,
+				   &heap->recycle_max);
+	}
 end:
 	mutex_unlock(&dev->lock);
 }
@@ -0,0 +1,263 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+/*
+ * Pages come back to a pool dirty and are zeroed by pool->zero_work, so
+ * that ion_page_pool_alloc can usually hand out a page that is ready to
+ * use. Pages of an uncached pool are also flushed from the cpu caches
+ * before they are handed out again.
+ */
+struct ion_page_pool {
+	spinlock_t lock;
+	struct list_head items;		/* zeroed pages */
+	struct list_head dirty;		/* pages waiting for zero_work */
+	int count;
+	int dirty_count;
+	gfp_t gfp_mask;
+	unsigned int order;
+	bool cached;
+	struct work_struct zero_work;
+	struct list_head node;		/* in ion_page_pools */
+};
+
+/* all pools, for the shrinker */
+static LIST_HEAD(ion_page_pools);
+static DEFINE_MUTEX(ion_page_pools_lock);
+
+static void ion_page_pool_sync(struct ion_page_pool *pool, struct page *page)
+{
+	struct scatterlist sg;
+
+	if (pool->cached)
+		return;
+
+	sg_init_table(&sg, 1);
+	sg_set_page(&sg, page, PAGE_SIZE << pool->order, 0);
+	sg_dma_address(&sg) = page_to_phys(page);
+	sg_dma_len(&sg) = sg.length;
+	dma_sync_sg_for_device(NULL, &sg, 1, DMA_BIDIRECTIONAL);
+}
+
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(nth_page(page, i));
+	ion_page_pool_sync(pool, page);
+}
+
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+
+	for (;;) {
+		spin_lock(&pool->lock);
+		if (list_empty(&pool->dirty)) {
+			spin_unlock(&pool->lock);
+			break;
+		}
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		ion_page_pool_zero(pool, page);
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->items);
+		pool->count++;
+		spin_unlock(&pool->lock);
+		cond_resched();
+	}
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	spin_lock(&pool->lock);
+	if (pool->count) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		pool->count--;
+	} else if (pool->dirty_count) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		pool->dirty_count--;
+		dirty = true;
+	}
+	if (page)
+		list_del(&page->lru);
+	spin_unlock(&pool->lock);
+
+	if (page) {
+		if (dirty)
+			ion_page_pool_zero(pool, page);
+		return page;
+	}
+
+	page = alloc_pages(pool->gfp_mask | __GFP_ZERO, pool->order);
+	if (page)
+		ion_page_pool_sync(pool, page);
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+	schedule_work(&pool->zero_work);
+}
+
+/* pages held by the pool, in PAGE_SIZE pages */
+static int ion_page_pool_total(struct ion_page_pool *pool)
+{
+	int total;
+
+	spin_lock(&pool->lock);
+	total = (pool->count + pool->dirty_count) << pool->order;
+	spin_unlock(&pool->lock);
+	return total;
+}
+
+/*
+ * Frees at least nr_to_scan PAGE_SIZE pages of the pool if it has them,
+ * dirty ones first, and returns the number of pages freed.
+ */
+static int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	int freed = 0;
+
+	while (freed < nr_to_scan) {
+		struct page *page = NULL;
+
+		spin_lock(&pool->lock);
+		if (pool->dirty_count) {
+			page = list_first_entry(&pool->dirty, struct page, lru);
+			pool->dirty_count--;
+		} else if (pool->count) {
+			page = list_first_entry(&pool->items, struct page, lru);
+			pool->count--;
+		}
+		if (page)
+			list_del(&page->lru);
+		spin_unlock(&pool->lock);
+
+		if (!page)
+			break;
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+	}
+
+	return freed;
+}
+
+static int ion_page_pool_shrink_all(struct shrinker *shrinker,
+				    struct shrink_control *sc)
+{
+	struct ion_page_pool *pool;
+	int nr_to_scan = sc->nr_to_scan;
+	int left = 0;
+
+	/* a pool is being created or destroyed, try again later */
+	if (!mutex_trylock(&ion_page_pools_lock))
+		return -1;
+
+	list_for_each_entry(pool, &ion_page_pools, node) {
+		if (nr_to_scan > 0)
+			nr_to_scan -= ion_page_pool_shrink(pool, nr_to_scan);
+		left += ion_page_pool_total(pool);
+	}
+	mutex_unlock(&ion_page_pools_lock);
+
+	return left;
+}
+
+static struct shrinker ion_page_pool_shrinker = {
+	.shrink = ion_page_pool_shrink_all,
+	.seeks = DEFAULT_SEEKS,
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool cached)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->items);
+	INIT_LIST_HEAD(&pool->dirty);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	pool->cached = cached;
+
+	mutex_lock(&ion_page_pools_lock);
+	if (list_empty(&ion_page_pools))
+		register_shrinker(&ion_page_pool_shrinker);
+	list_add_tail(&pool->node, &ion_page_pools);
+	mutex_unlock(&ion_page_pools_lock);
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	mutex_lock(&ion_page_pools_lock);
+	list_del(&pool->node);
+	if (list_empty(&ion_page_pools))
+		unregister_shrinker(&ion_page_pool_shrinker);
+	mutex_unlock(&ion_page_pools_lock);
+
+	cancel_work_sync(&pool->zero_work);
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
+
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s)
+{
+	int count, dirty_count;
+
+	spin_lock(&pool->lock);
+	count = pool->count;
+	dirty_count = pool->dirty_count;
+	spin_unlock(&pool->lock);
+
+	seq_printf(s, "%s order %u pool: %d zeroed, %d dirty (%lu bytes)\n",
+		   pool->cached ? "cached" : "uncached", pool->order,
+		   count, dirty_count,
+		   (unsigned long)(count + dirty_count) <<
+		   (PAGE_SHIFT + pool->order));
+}
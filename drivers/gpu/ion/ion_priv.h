@@ -22,6 +22,8 @@
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/ion.h>
 #include <linux/iommu.h>
 
@@ -70,7 +72,8 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 /**
  * struct ion_buffer - metadata for a particular buffer
  * @ref:		refernce count
- * @node:		node in the ion_device buffers tree
+ * @node:		node in the ion_device buffers tree, or in the recycle
+ *			tree of its heap once it has been freed
  * @dev:		back pointer to the ion_device
  * @heap:		back pointer to the heap the buffer came from
  * @flags:		buffer specific flags
@@ -84,6 +87,9 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sglist:		the scatterlist for the buffer is dmap_cnt is not zero
+ * @alloc_flags:	flags the buffer was allocated with
+ * @free_list:		entry in the free_list or recycle_lru of its heap
+ * @free_time:		jiffies when the buffer went into the recycle cache
 */
 struct ion_buffer {
 	struct kref ref;
@@ -105,6 +111,9 @@ struct ion_buffer {
 	unsigned int iommu_map_cnt;
 	struct rb_root iommu_maps;
 	int marked;
+	unsigned long alloc_flags;
+	struct list_head free_list;
+	unsigned long free_time;
 };
 
 /**
@@ -162,6 +171,21 @@ struct ion_heap_ops {
  *			allocating.  These are specified by platform data and
  *			MUST be unique
  * @name:		used for debugging
+ * @flags:		ION_HEAP_FLAG_* flags
+ * @free_lock:		protects the free list, the recycle cache and their
+ *			sizes
+ * @free_list:		buffers waiting to be freed by free_task
+ * @free_list_size:	bytes on free_list
+ * @recycle:		freed buffers kept for reuse, keyed by size
+ * @recycle_lru:	the same buffers, least recently freed first
+ * @recycle_size:	bytes in the recycle cache
+ * @recycle_max:	bytes the recycle cache may hold
+ * @recycle_hits:	allocations served from the recycle cache
+ * @recycle_shrink:	bytes of the recycle cache the shrinker asked
+ *			free_task to give back
+ * @recycle_node:	entry in the list of heaps the shrinker looks at
+ * @free_wait:		wakes up free_task
+ * @free_task:		frees buffers of a heap with ION_HEAP_FLAG_DEFER_FREE
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -175,6 +199,19 @@ struct ion_heap {
 	struct ion_heap_ops *ops;
 	int id;
 	const char *name;
+	unsigned long flags;
+	spinlock_t free_lock;
+	struct list_head free_list;
+	size_t free_list_size;
+	struct rb_root recycle;
+	struct list_head recycle_lru;
+	size_t recycle_size;
+	u32 recycle_max;
+	unsigned long recycle_hits;
+	size_t recycle_shrink;
+	struct list_head recycle_node;
+	wait_queue_head_t free_wait;
+	struct task_struct *free_task;
 };
 
 
@@ -215,6 +252,13 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
 void ion_heap_destroy(struct ion_heap *);
 
+/**
+ * ion_heap_deferred_free_stop - stops the free thread of a heap and frees
+ * the buffers it still holds
+ * @heap:		the heap, which may or may not defer frees
+ */
+void ion_heap_deferred_free_stop(struct ion_heap *heap);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *);
 void ion_system_heap_destroy(struct ion_heap *);
 
@@ -242,6 +286,21 @@ ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap, unsigned long size,
 void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 		       unsigned long size);
 
+/**
+ * functions for the page pools of the system heap
+ *
+ * A pool keeps pages of a single order that were freed by its heap, and
+ * hands them out again zeroed. Freed pages are zeroed in the background.
+ * All pools are drained by a common shrinker.
+ */
+struct ion_page_pool;
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool cached);
+void ion_page_pool_destroy(struct ion_page_pool *pool);
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool);
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page);
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s);
 
 struct ion_heap *msm_get_contiguous_heap(void);
 /**
@@ -30,51 +30,194 @@
 static atomic_t system_heap_allocated;
 static atomic_t system_contig_heap_allocated;
 
+/*
+ * The system heap allocates in the largest of these orders that fits the
+ * rest of the buffer, falling back to smaller ones, and keeps freed chunks
+ * in a cached and an uncached page pool per order.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[NUM_ORDERS];
+	struct ion_page_pool *cached_pools[NUM_ORDERS];
+};
+
+/*
+ * priv_virt of a system heap buffer. The head page of each chunk keeps
+ * the order of the chunk in page_private.
+ */
+struct ion_system_buffer {
+	struct page **pages;
+	int nrpages;
+	bool cached;
+};
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct ion_page_pool *ion_system_pool(struct ion_system_heap *heap,
+					     bool cached, unsigned int order)
+{
+	int i = order_to_index(order);
+
+	return cached ? heap->cached_pools[i] : heap->pools[i];
+}
+
+static struct page *alloc_largest_available(struct ion_system_heap *heap,
+					    bool cached, unsigned long size,
+					    unsigned int max_order,
+					    unsigned int *order)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (size < (PAGE_SIZE << orders[i]))
+			continue;
+		if (orders[i] > max_order)
+			continue;
+
+		page = ion_page_pool_alloc(ion_system_pool(heap, cached,
+							   orders[i]));
+		if (!page)
+			continue;
+		*order = orders[i];
+		return page;
+	}
+	return NULL;
+}
+
+static void ion_system_free_chunks(struct ion_system_heap *heap,
+				   struct ion_system_buffer *info, int nrpages)
+{
+	int i;
+	unsigned int order;
+
+	for (i = 0; i < nrpages; i += 1 << order) {
+		struct page *page = info->pages[i];
+
+		order = page_private(page);
+		set_page_private(page, 0);
+		ion_page_pool_free(ion_system_pool(heap, info->cached, order),
+				   page);
+	}
+}
+
+static void *ion_system_pages_alloc(size_t size)
+{
+	if (size <= PAGE_SIZE)
+		return kmalloc(size, GFP_KERNEL);
+	return vmalloc(size);
+}
+
+static void ion_system_pages_free(void *pages)
+{
+	if (is_vmalloc_addr(pages))
+		vfree(pages);
+	else
+		kfree(pages);
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
-	buffer->priv_virt = vmalloc_user(size);
-	if (!buffer->priv_virt)
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	struct ion_system_buffer *info;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
+	int i = 0;
+
+	info = kmalloc(sizeof(*info), GFP_KERNEL);
+	if (!info)
 		return -ENOMEM;
+	info->nrpages = size_remaining >> PAGE_SHIFT;
+	info->cached = ION_IS_CACHED(flags);
+	info->pages = ion_system_pages_alloc(info->nrpages *
+					     sizeof(struct page *));
+	if (!info->pages)
+		goto err;
+
+	while (size_remaining > 0) {
+		struct page *page;
+		unsigned int order;
+		int j;
+
+		page = alloc_largest_available(sys_heap, info->cached,
+					       size_remaining, max_order,
+					       &order);
+		if (!page)
+			goto err_free_chunks;
+		set_page_private(page, order);
+		for (j = 0; j < (1 << order); j++)
+			info->pages[i++] = nth_page(page, j);
+		size_remaining -= PAGE_SIZE << order;
+		max_order = order;
+	}
 
+	buffer->priv_virt = info;
 	atomic_add(size, &system_heap_allocated);
 	return 0;
+
+err_free_chunks:
+	ion_system_free_chunks(sys_heap, info, i);
+	ion_system_pages_free(info->pages);
+err:
+	kfree(info);
+	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
-	vfree(buffer->priv_virt);
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
+	struct ion_system_buffer *info = buffer->priv_virt;
+
+	ion_system_free_chunks(sys_heap, info, info->nrpages);
+	ion_system_pages_free(info->pages);
+	kfree(info);
 	atomic_sub(buffer->size, &system_heap_allocated);
 }
 
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
+	struct ion_system_buffer *info = buffer->priv_virt;
 	struct scatterlist *sglist;
-	struct page *page;
-	int i;
-	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	void *vaddr = buffer->priv_virt;
+	int nents = 0;
+	int i, n;
+	unsigned int order;
 
-	sglist = vmalloc(npages * sizeof(struct scatterlist));
+	for (i = 0; i < info->nrpages; i += 1 << order) {
+		order = page_private(info->pages[i]);
+		nents++;
+	}
+
+	sglist = vmalloc(nents * sizeof(struct scatterlist));
 	if (!sglist)
 		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, npages * sizeof(struct scatterlist));
-	sg_init_table(sglist, npages);
-	for (i = 0; i < npages; i++) {
-		page = vmalloc_to_page(vaddr);
-		if (!page)
-			goto end;
-		sg_set_page(&sglist[i], page, PAGE_SIZE, 0);
-		vaddr += PAGE_SIZE;
+	memset(sglist, 0, nents * sizeof(struct scatterlist));
+	sg_init_table(sglist, nents);
+	for (i = 0, n = 0; i < info->nrpages; i += 1 << order, n++) {
+		order = page_private(info->pages[i]);
+		sg_set_page(&sglist[n], info->pages[i], PAGE_SIZE << order, 0);
 	}
 	/* XXX do cache maintenance for dma? */
 	return sglist;
-end:
-	vfree(sglist);
-	return NULL;
 }
 
 void ion_system_heap_unmap_dma(struct ion_heap *heap,
@@ -89,17 +232,23 @@ void *ion_system_heap_map_kernel(struct ion_heap *heap,
 				 struct ion_buffer *buffer,
 				 unsigned long flags)
 {
-	if (ION_IS_CACHED(flags))
-		return buffer->priv_virt;
-	else {
-		pr_err("%s: cannot map system heap uncached\n", __func__);
-		return ERR_PTR(-EINVAL);
-	}
+	struct ion_system_buffer *info = buffer->priv_virt;
+	pgprot_t page_prot = PAGE_KERNEL;
+	void *vaddr;
+
+	if (!ION_IS_CACHED(flags))
+		page_prot = pgprot_noncached(page_prot);
+
+	vaddr = vmap(info->pages, info->nrpages, VM_MAP, page_prot);
+	if (!vaddr)
+		return ERR_PTR(-ENOMEM);
+	return vaddr;
 }
 
 void ion_system_heap_unmap_kernel(struct ion_heap *heap,
 				  struct ion_buffer *buffer)
 {
+	vunmap(buffer->vaddr);
 }
 
 void ion_system_heap_unmap_iommu(struct ion_iommu_map *data)
@@ -136,21 +285,45 @@ void ion_system_heap_unmap_iommu(struct ion_iommu_map *data)
 int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			     struct vm_area_struct *vma, unsigned long flags)
 {
-	if (ION_IS_CACHED(flags))
-		return remap_vmalloc_range(vma, buffer->priv_virt,
-						vma->vm_pgoff);
-	else {
-		pr_err("%s: cannot map system heap uncached\n", __func__);
-		return -EINVAL;
+	struct ion_system_buffer *info = buffer->priv_virt;
+	unsigned long addr = vma->vm_start;
+	unsigned long offset = vma->vm_pgoff;
+	unsigned int order;
+	int i;
+
+	if (!ION_IS_CACHED(flags))
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	for (i = 0; i < info->nrpages && addr < vma->vm_end; i += 1 << order) {
+		struct page *page = info->pages[i];
+		unsigned long len;
+		int ret;
+
+		order = page_private(page);
+		if (offset >= (1 << order)) {
+			offset -= 1 << order;
+			continue;
+		}
+
+		len = min(((1UL << order) - offset) << PAGE_SHIFT,
+			  vma->vm_end - addr);
+		ret = remap_pfn_range(vma, addr, page_to_pfn(page) + offset,
+				      len, vma->vm_page_prot);
+		if (ret)
+			return ret;
+		addr += len;
+		offset = 0;
 	}
+
+	return 0;
 }
 
 int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 			void *vaddr, unsigned int offset, unsigned int length,
 			unsigned int cmd)
 {
+	struct ion_system_buffer *info = buffer->priv_virt;
 	unsigned long vstart, pstart;
-	void *vtemp;
 	unsigned long ln = 0;
 	void (*op)(unsigned long, unsigned long, unsigned long);
 
@@ -168,22 +341,15 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 		return -EINVAL;
 	}
 
-	for (vtemp = buffer->priv_virt + offset,
-	     vstart = (unsigned long) vaddr;
-			ln < length;
-			vtemp += PAGE_SIZE, ln += PAGE_SIZE,
-			vstart += PAGE_SIZE) {
-		pstart = page_to_phys(vmalloc_to_page(vtemp));
-		/*
-		 * If vmalloc -> page -> phys is returning NULL, something
-		 * has really gone wrong...
-		 */
-		if (!pstart) {
-			WARN(1, "Could not translate %p to physical address\n",
-				vtemp);
+	for (vstart = (unsigned long) vaddr; ln < length;
+			ln += PAGE_SIZE, vstart += PAGE_SIZE) {
+		unsigned long pgoff = (offset + ln) >> PAGE_SHIFT;
+
+		if (pgoff >= info->nrpages) {
+			WARN(1, "Cache op past the end of the buffer\n");
 			return -EINVAL;
 		}
-
+		pstart = page_to_phys(info->pages[pgoff]);
 		op(vstart, PAGE_SIZE, pstart);
 	}
 
@@ -192,8 +358,17 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 
 static int ion_system_print_debug(struct ion_heap *heap, struct seq_file *s)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
 	seq_printf(s, "total bytes currently allocated: %lx\n",
 			(unsigned long) atomic_read(&system_heap_allocated));
+	for (i = 0; i < NUM_ORDERS; i++) {
+		ion_page_pool_print_debug(sys_heap->pools[i], s);
+		ion_page_pool_print_debug(sys_heap->cached_pools[i], s);
+	}
 
 	return 0;
 }
@@ -206,10 +381,10 @@ int ion_system_heap_map_iommu(struct ion_buffer *buffer,
 				unsigned long iova_length,
 				unsigned long flags)
 {
-	int ret, i;
+	struct ion_system_buffer *info = buffer->priv_virt;
+	int ret, i, j;
 	unsigned long temp_iova;
 	struct iommu_domain *domain;
-	void *temp_phys;
 	unsigned long extra;
 
 	if (!ION_IS_CACHED(flags))
@@ -237,17 +412,16 @@ int ion_system_heap_map_iommu(struct ion_buffer *buffer,
 	}
 
 	temp_iova = data->iova_addr;
-	temp_phys = buffer->vaddr;
-	for (i = buffer->size; i > 0; i -= SZ_4K, temp_iova += SZ_4K,
-						  temp_phys += SZ_4K) {
+	for (i = buffer->size, j = 0; i > 0; i -= SZ_4K, temp_iova += SZ_4K,
+						  j++) {
 		ret = iommu_map(domain, temp_iova,
-			page_to_phys(vmalloc_to_page(temp_phys)),
+			page_to_phys(info->pages[j]),
 			get_order(SZ_4K), ION_IS_CACHED(flags) ? 1 : 0);
 
 		if (ret) {
 			pr_err("%s: could not map %lx to %x in domain %p\n",
 				__func__, temp_iova,
-				page_to_phys(vmalloc_to_page(temp_phys)),
+				page_to_phys(info->pages[j]),
 				domain);
 			goto out2;
 		}
@@ -283,21 +457,62 @@ static struct ion_heap_ops vmalloc_ops = {
 	.unmap_iommu = ion_system_heap_unmap_iommu,
 };
 
+/* high orders are opportunistic: don't reclaim or warn for them */
+static gfp_t high_order_gfp_flags = (GFP_HIGHUSER | __GFP_NOWARN |
+				     __GFP_NORETRY | __GFP_NO_KSWAPD) &
+				    ~__GFP_WAIT;
+static gfp_t low_order_gfp_flags = GFP_HIGHUSER | __GFP_NOWARN;
+
+static void ion_system_heap_destroy_pools(struct ion_system_heap *heap)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (heap->pools[i])
+			ion_page_pool_destroy(heap->pools[i]);
+		if (heap->cached_pools[i])
+			ion_page_pool_destroy(heap->cached_pools[i]);
+	}
+}
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
+	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	heap->heap.ops = &vmalloc_ops;
+	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_t gfp_flags = low_order_gfp_flags;
+
+		if (orders[i] > 0)
+			gfp_flags = high_order_gfp_flags;
+		heap->pools[i] = ion_page_pool_create(gfp_flags, orders[i],
+						      false);
+		heap->cached_pools[i] = ion_page_pool_create(gfp_flags,
+							     orders[i], true);
+		if (!heap->pools[i] || !heap->cached_pools[i]) {
+			ion_system_heap_destroy_pools(heap);
+			kfree(heap);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+	return &heap->heap;
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+
+	ion_system_heap_destroy_pools(sys_heap);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -341,6 +556,23 @@ struct scatterlist *ion_system_contig_heap_map_dma(struct ion_heap *heap,
 	return sglist;
 }
 
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+				 struct ion_buffer *buffer,
+				 unsigned long flags)
+{
+	if (ION_IS_CACHED(flags))
+		return buffer->priv_virt;
+	else {
+		pr_err("%s: cannot map system heap uncached\n", __func__);
+		return ERR_PTR(-EINVAL);
+	}
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+				  struct ion_buffer *buffer)
+{
+}
+
 int ion_system_contig_heap_map_user(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    struct vm_area_struct *vma,
@@ -474,8 +706,8 @@ static struct ion_heap_ops kmalloc_ops = {
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
 	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
 	.cache_op = ion_system_contig_heap_cache_ops,
 	.print_debug = ion_system_contig_print_debug,
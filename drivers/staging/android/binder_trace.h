@@ -0,0 +1,189 @@
+/* binder_trace.h
+ *
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct binder_buffer;
+struct binder_node;
+struct binder_proc;
+struct binder_thread;
+struct binder_transaction;
+
+/**
+ * binder_transaction - a transaction or reply is queued for its target
+ * @reply:	true for BC_REPLY
+ * @t:		the new transaction
+ * @target_node: the node the transaction is sent to, NULL for a reply
+ */
+TRACE_EVENT(binder_transaction,
+
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+
+	TP_ARGS(reply, t, target_node),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->reply, __entry->flags, __entry->code)
+);
+
+/**
+ * binder_transaction_alloc_buf - the target buffer of a transaction
+ * @t:		the transaction
+ * @alloc_us:	time spent allocating the buffer
+ */
+TRACE_EVENT(binder_transaction_alloc_buf,
+
+	TP_PROTO(struct binder_transaction *t, unsigned long alloc_us),
+
+	TP_ARGS(t, alloc_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+		__field(unsigned long, alloc_us)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->data_size = t->buffer->data_size;
+		__entry->offsets_size = t->buffer->offsets_size;
+		__entry->alloc_us = alloc_us;
+	),
+
+	TP_printk("transaction=%d data_size=%zd offsets_size=%zd "
+		  "alloc_us=%lu",
+		  __entry->debug_id, __entry->data_size,
+		  __entry->offsets_size, __entry->alloc_us)
+);
+
+/**
+ * binder_wakeup - a thread in binder_thread_read stopped waiting
+ * @proc_work:	it waited for work queued on the proc, not on the thread
+ * @ret:	0, or the error that ended the wait
+ */
+TRACE_EVENT(binder_wakeup,
+
+	TP_PROTO(bool proc_work, int ret),
+
+	TP_ARGS(proc_work, ret),
+
+	TP_STRUCT__entry(
+		__field(int, proc_work)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->proc_work = proc_work;
+		__entry->ret = ret;
+	),
+
+	TP_printk("proc_work=%d ret=%d", __entry->proc_work, __entry->ret)
+);
+
+/**
+ * binder_transaction_received - a thread read a transaction or reply
+ * @t:		the transaction
+ * @queued_us:	time between queueing the transaction and this read
+ */
+TRACE_EVENT(binder_transaction_received,
+
+	TP_PROTO(struct binder_transaction *t, unsigned long queued_us),
+
+	TP_ARGS(t, queued_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(unsigned long, queued_us)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->queued_us = queued_us;
+	),
+
+	TP_printk("transaction=%d queued_us=%lu",
+		  __entry->debug_id, __entry->queued_us)
+);
+
+/**
+ * binder_reply - the callee of a synchronous transaction replied
+ * @t:		the transaction that is answered
+ * @reply:	the reply
+ * @callee_us:	time between reading @t and sending @reply
+ * @total_us:	time between sending @t and sending @reply
+ */
+TRACE_EVENT(binder_reply,
+
+	TP_PROTO(struct binder_transaction *t, struct binder_transaction *reply,
+		 unsigned long callee_us, unsigned long total_us),
+
+	TP_ARGS(t, reply, callee_us, total_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply_id)
+		__field(unsigned long, callee_us)
+		__field(unsigned long, total_us)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->reply_id = reply->debug_id;
+		__entry->callee_us = callee_us;
+		__entry->total_us = total_us;
+	),
+
+	TP_printk("transaction=%d reply=%d callee_us=%lu total_us=%lu",
+		  __entry->debug_id, __entry->reply_id,
+		  __entry->callee_us, __entry->total_us)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
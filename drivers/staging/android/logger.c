@@ -21,29 +21,60 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * The biggest entry that can be in a log, header included.
+ */
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/* payloads up to this size are staged on the writer's stack */
+#define LOGGER_WRITE_STACK_LEN	256
+
+/* a segment holds at least this many bytes, so it fits a few big entries */
+#define LOGGER_MIN_SEGMENT_SIZE	(16*1024)
+
+/*
+ * struct logger_segment - one ring of a log
+ *
+ * Each log is split into a power-of-two number of segments (just one unless
+ * CONFIG_ANDROID_LOGGER_PER_CPU is set), and writers only use the segment of
+ * the cpu they run on. Positions grow without wrapping, so
+ * a reader that was lapped finds its position below 'head' and simply jumps
+ * there. All fields and the data are protected by 'lock'.
+ */
+struct logger_segment {
+	spinlock_t		lock;	/* protects the segment */
+	unsigned char		*buffer;/* this segment's part of the log */
+	u64			head;	/* position of the oldest entry */
+	u64			tail;	/* position of the next entry */
+} ____cacheline_aligned_in_smp;
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. Its contents live in 'segs', which
+ * are set up at init and never change afterwards.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct logger_segment	*segs;	/* per-cpu segments of 'buffer' */
+	struct logger_mmap_header *ctl;	/* segment state for mmap readers */
+	int			nr_segs;/* number of segments */
+	size_t			seg_size; /* size of each segment */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,20 +82,23 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes users of this reader */
 	bool			r_all;	/* reader can read all entries */
+	bool			batch;	/* read() returns as many entries as fit */
 	int			r_ver;	/* reader ABI version */
+	__u32			*cursor; /* r_pos as shared through mmap */
+	unsigned char		*scratch; /* entry copied out of a segment */
+	u64			r_pos[0]; /* read position in each segment */
 };
 
-/* logger_offset - returns index 'n' into the log via (optimized) modulus */
-size_t logger_offset(struct logger_log *log, size_t n)
+/* logger_offset - returns the index of position 'pos' into a segment */
+static size_t logger_offset(struct logger_log *log, u64 pos)
 {
-	return n & (log->size-1);
+	return (size_t)pos & (log->seg_size - 1);
 }
 
 
@@ -91,44 +125,175 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * seg_read - copies 'len' bytes at position 'pos' of 'seg' into 'dst',
+ * wrapping around the end of the segment.
+ *
+ * Caller must hold seg->lock.
+ */
+static void seg_read(struct logger_log *log, struct logger_segment *seg,
+		     u64 pos, void *dst, size_t len)
+{
+	size_t off = logger_offset(log, pos);
+	size_t n = min(len, log->seg_size - off);
+
+	memcpy(dst, seg->buffer + off, n);
+	if (n != len)
+		memcpy(dst + n, seg->buffer, len - n);
+}
+
+/*
+ * seg_write - copies 'len' bytes from 'src' to the tail of 'seg' and
+ * advances the tail.
+ *
+ * Caller must hold seg->lock and have made room for the bytes.
+ */
+static void seg_write(struct logger_log *log, struct logger_segment *seg,
+		      const void *src, size_t len)
+{
+	size_t off = logger_offset(log, seg->tail);
+	size_t n = min(len, log->seg_size - off);
+
+	memcpy(seg->buffer + off, src, n);
+	if (n != len)
+		memcpy(seg->buffer, src + n, len - n);
+	seg->tail += len;
+}
+
 /*
  * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * 'seg' at position 'pos'. A temporary logger_entry 'scratch' must be
+ * provided. Typically the return value will be a pointer within the segment.
+ * However, a pointer to 'scratch' may be returned if the log entry spans the
+ * end and beginning of the segment.
+ *
+ * Caller must hold seg->lock.
  */
 static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+		struct logger_segment *seg, u64 pos,
+		struct logger_entry *scratch)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
+	size_t off = logger_offset(log, pos);
+
+	if (log->seg_size - off < sizeof(struct logger_entry)) {
+		seg_read(log, seg, pos, scratch, sizeof(struct logger_entry));
 		return scratch;
 	}
 
-	return (struct logger_entry *) (log->buffer + off);
+	return (struct logger_entry *) (seg->buffer + off);
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
+ * seg_next_entry - returns the header of the first entry at or after '*pos'
+ * in segment 'i' that 'reader' may read, or NULL if there is none. '*pos' is
+ * pulled forward over entries that were overwritten or are not readable.
  *
- * An entry length is 2 bytes (16 bits) in host endian order.
- * In the log, the length does not include the size of the log entry structure.
- * This function returns the size including the log entry structure.
+ * Caller must hold the segment's lock.
+ */
+static struct logger_entry *seg_next_entry(struct logger_reader *reader,
+		int i, u64 *pos, struct logger_entry *scratch)
+{
+	struct logger_log *log = reader->log;
+	struct logger_segment *seg = &log->segs[i];
+
+	if (*pos < seg->head)
+		*pos = seg->head;
+
+	while (*pos < seg->tail) {
+		struct logger_entry *entry;
+
+		entry = get_entry_header(log, seg, *pos, scratch);
+		/* an mmap reader may have set its cursor to garbage */
+		if (unlikely(entry->len > LOGGER_ENTRY_MAX_PAYLOAD))
+			break;
+		if (reader->r_all || entry->euid == current_euid())
+			return entry;
+		*pos += sizeof(struct logger_entry) + entry->len;
+	}
+
+	*pos = seg->tail;
+	return NULL;
+}
+
+/*
+ * logger_next_segment - returns the segment holding the oldest entry that
+ * 'reader' can read next, or -1 if there is nothing to read. Entries of
+ * different segments are merged by their timestamp.
  *
- * Caller needs to hold log->mutex.
+ * Caller must hold reader->mutex, unless 'peek' is set, in which case the
+ * reader's positions are left untouched.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static int logger_next_segment(struct logger_reader *reader, bool peek)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	struct logger_log *log = reader->log;
+	s32 sec = 0, nsec = 0;
+	int i, best = -1;
+
+	for (i = 0; i < log->nr_segs; i++) {
+		struct logger_segment *seg = &log->segs[i];
+		struct logger_entry scratch;
+		struct logger_entry *entry;
+		u64 pos = reader->r_pos[i];
+
+		spin_lock(&seg->lock);
+		entry = seg_next_entry(reader, i, &pos, &scratch);
+		if (entry && (best < 0 || entry->sec < sec ||
+			      (entry->sec == sec && entry->nsec < nsec))) {
+			best = i;
+			sec = entry->sec;
+			nsec = entry->nsec;
+		}
+		spin_unlock(&seg->lock);
+		if (!peek)
+			reader->r_pos[i] = pos;
+	}
+
+	return best;
+}
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+/*
+ * logger_cursor_in - takes over the positions an mmap reader left in its
+ * cursor page. Positions outside of the segment are treated as lapped.
+ *
+ * Caller must hold reader->mutex.
+ */
+static void logger_cursor_in(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	int i;
+
+	if (!reader->cursor)
+		return;
+
+	for (i = 0; i < log->nr_segs; i++) {
+		struct logger_segment *seg = &log->segs[i];
+		u32 behind;
+
+		spin_lock(&seg->lock);
+		behind = (u32)seg->tail - ACCESS_ONCE(reader->cursor[i]);
+		if (behind > seg->tail - seg->head)
+			reader->r_pos[i] = seg->head;
+		else
+			reader->r_pos[i] = seg->tail - behind;
+		spin_unlock(&seg->lock);
+	}
+}
+
+/*
+ * logger_cursor_out - publishes the positions of 'reader' in its cursor
+ * page, if it has one.
+ *
+ * Caller must hold reader->mutex.
+ */
+static void logger_cursor_out(struct logger_reader *reader)
+{
+	int i;
+
+	if (!reader->cursor)
+		return;
+
+	for (i = 0; i < reader->log->nr_segs; i++)
+		reader->cursor[i] = (u32)reader->r_pos[i];
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -164,79 +329,75 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * get_next_entry_len - returns the size the next entry of 'reader' has in
+ * user space, 0 if there is none.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t get_next_entry_len(struct logger_reader *reader)
 {
+	struct logger_log *log = reader->log;
 	struct logger_entry scratch;
 	struct logger_entry *entry;
-	size_t len;
-	size_t msg_start;
-
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
-
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
-
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+	ssize_t ret = 0;
+	int i;
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+	i = logger_next_segment(reader, false);
+	if (i < 0)
+		return 0;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+	spin_lock(&log->segs[i].lock);
+	entry = seg_next_entry(reader, i, &reader->r_pos[i], &scratch);
+	if (entry)
+		ret = get_user_hdr_len(reader->r_ver) + entry->len;
+	spin_unlock(&log->segs[i].lock);
 
-	return count + get_user_hdr_len(reader->r_ver);
+	return ret;
 }
 
 /*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
+ * do_read_log_to_user - reads the next entry of segment 'i' into the
+ * user-space buffer 'buf' of 'count' bytes. Returns the size of the entry,
+ * 0 if the segment has been drained in the meantime, or -EINVAL if the
+ * entry does not fit in 'count' bytes.
+ *
+ * The entry is copied out under the segment lock into reader->scratch and
+ * handed to user space from there. Caller must hold reader->mutex.
  */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static ssize_t do_read_log_to_user(struct logger_reader *reader, int i,
+				   char __user *buf, size_t count)
 {
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
+	struct logger_log *log = reader->log;
+	struct logger_segment *seg = &log->segs[i];
+	struct logger_entry *entry = (struct logger_entry *) reader->scratch;
+	struct logger_entry *hdr;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
+	u64 old_pos = reader->r_pos[i];
+	size_t len;
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(log, off + next_len);
+	spin_lock(&seg->lock);
+	hdr = seg_next_entry(reader, i, &reader->r_pos[i], entry);
+	if (!hdr) {
+		spin_unlock(&seg->lock);
+		return 0;
+	}
+	if (count < hdr_len + hdr->len) {
+		spin_unlock(&seg->lock);
+		return -EINVAL;
+	}
+	len = sizeof(struct logger_entry) + hdr->len;
+	seg_read(log, seg, reader->r_pos[i], entry, len);
+	reader->r_pos[i] += len;
+	spin_unlock(&seg->lock);
+
+	if (copy_header_to_user(reader->r_ver, entry, buf) ||
+	    copy_to_user(buf + hdr_len, entry->msg, entry->len)) {
+		/* leave the entry for the next read, if it is still there */
+		reader->r_pos[i] = old_pos;
+		return -EFAULT;
 	}
 
-	return off;
+	return hdr_len + entry->len;
 }
 
 /*
@@ -246,7 +407,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
  *
  *	- O_NONBLOCK works
  *	- If there are no log entries to read, blocks until log is written to
- *	- Atomically reads exactly one log entry
+ *	- Atomically reads exactly one log entry, or in batch mode as many
+ *	  whole entries as fit, without blocking once one was read
  *
  * Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -256,208 +418,107 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
-	ssize_t ret;
-	DEFINE_WAIT(wait);
+	ssize_t ret = 0;
+	size_t done = 0;
+	int i;
 
-start:
 	while (1) {
-		mutex_lock(&log->mutex);
-
-		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
-
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
-			break;
-
-		if (file->f_flags & O_NONBLOCK) {
-			ret = -EAGAIN;
-			break;
+		mutex_lock(&reader->mutex);
+		logger_cursor_in(reader);
+		while ((i = logger_next_segment(reader, false)) >= 0) {
+			ret = do_read_log_to_user(reader, i, buf + done,
+						  count - done);
+			/* zero means we raced with a flush */
+			if (ret < 0 || (ret > 0 && !reader->batch))
+				break;
+			done += ret;
 		}
-
-		if (signal_pending(current)) {
-			ret = -EINTR;
-			break;
-		}
-
-		schedule();
-	}
-
-	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
+		logger_cursor_out(reader);
+		mutex_unlock(&reader->mutex);
+
+		/* a batch ends at the first entry that does not fit */
+		if (done)
+			return done;
+		if (i >= 0 && ret)
+			return ret;
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(log->wq,
+				logger_next_segment(reader, true) >= 0);
+		if (ret)
+			return -EINTR;
 	}
-
-	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
-
-	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_make_room - drops the oldest entries of 'seg' until 'len' more
+ * bytes fit. Readers still pointing at them notice on their next access.
  *
- * Caller must hold log->mutex.
+ * Caller must hold seg->lock.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void logger_make_room(struct logger_log *log,
+			     struct logger_segment *seg, size_t len)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+	while (seg->tail + len - seg->head > log->seg_size) {
+		struct logger_entry scratch;
+		struct logger_entry *entry;
 
-/*
- * is_between - is a < c < b, accounting for wrapping of a, b, and c
- *    positions in the buffer
- *
- * That is, if a<b, check for c between a and b
- * and if a>b, check for c outside (not between) a and b
- *
- * |------- a xxxxxxxx b --------|
- *               c^
- *
- * |xxxxx b --------- a xxxxxxxxx|
- *    c^
- *  or                    c^
- */
-static inline int is_between(size_t a, size_t b, size_t c)
-{
-	if (a < b) {
-		/* is c between a and b? */
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		/* is c outside of b through a? */
-		if (c <= b || a < c)
-			return 1;
+		entry = get_entry_header(log, seg, seg->head, &scratch);
+		seg->head += sizeof(struct logger_entry) + entry->len;
 	}
-
-	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * logger_publish_head - tells mmap readers about a new head of 'seg'. This
+ * has to be visible before the old entries are overwritten.
  *
- * The caller needs to hold log->mutex.
+ * Caller must hold seg->lock.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_publish_head(struct logger_log *log,
+				struct logger_segment *seg)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
-
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	ACCESS_ONCE(log->ctl->seg[seg - log->segs].head) = (u32)seg->head;
+	smp_wmb();
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_publish_tail - tells mmap readers about a new tail of 'seg', once
+ * the entries in front of it are complete.
  *
- * The caller needs to hold log->mutex.
+ * Caller must hold seg->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_publish_tail(struct logger_log *log,
+				struct logger_segment *seg)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
-}
-
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			/*
-			 * Note that by not updating w_off, this abandons the
-			 * portion of the new entry that *was* successfully
-			 * copied, just above.  This is intentional to avoid
-			 * message corruption from missing fragments.
-			 */
-			return -EFAULT;
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
-	return count;
+	smp_wmb();
+	ACCESS_ONCE(log->ctl->seg[seg - log->segs].tail) = (u32)seg->tail;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered from user space before any lock is taken. The
+ * entry then goes into the segment of the current cpu, so writers on
+ * different cpus do not contend with each other, and nothing is done for
+ * the readers besides waking them.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_segment *seg;
 	struct logger_entry header;
 	struct timespec now;
+	char stack_buf[LOGGER_WRITE_STACK_LEN];
+	char *payload = stack_buf;
 	ssize_t ret = 0;
 
-	now = current_kernel_time();
-
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 	header.hdr_size = sizeof(struct logger_entry);
@@ -466,42 +527,51 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	if (header.len > sizeof(stack_buf)) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (!payload)
+			return -ENOMEM;
+	}
 
+	while (nr_segs-- > 0 && ret < header.len) {
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		size_t len = min_t(size_t, iov->iov_len, header.len - ret);
+
+		/*
+		 * A fault abandons the whole entry, to avoid message
+		 * corruption from missing fragments.
+		 */
+		if (copy_from_user(payload + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
+	header.len = ret;
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	seg = &log->segs[raw_smp_processor_id() & (log->nr_segs - 1)];
+	spin_lock(&seg->lock);
+	/* stamped under the lock, so each segment stays in time order */
+	getnstimeofday(&now);
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	logger_make_room(log, seg, sizeof(struct logger_entry) + header.len);
+	logger_publish_head(log, seg);
+	seg_write(log, seg, &header, sizeof(struct logger_entry));
+	seg_write(log, seg, payload, header.len);
+	logger_publish_tail(log, seg);
+	spin_unlock(&seg->lock);
+
+	/* wake up any blocked readers, pairs with prepare_to_wait() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
+out:
+	if (payload != stack_buf)
+		kfree(payload);
 	return ret;
 }
 
@@ -528,21 +598,30 @@ static int logger_open(struct inode *inode, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
 
-		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
+		int i;
+
+		reader = kmalloc(sizeof(struct logger_reader) +
+				 log->nr_segs * sizeof(u64), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
+		reader->scratch = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->scratch) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
+		reader->batch = false;
+		reader->cursor = NULL;
+		mutex_init(&reader->mutex);
 
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		/* new readers start at the oldest entries */
+		for (i = 0; i < log->nr_segs; i++)
+			reader->r_pos[i] = 0;
 
 		file->private_data = reader;
 	} else
@@ -560,12 +639,10 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 
+		if (reader->cursor)
+			free_page((unsigned long) reader->cursor);
+		kfree(reader->scratch);
 		kfree(reader);
 	}
 
@@ -595,14 +672,12 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	logger_cursor_in(reader);
+	if (logger_next_segment(reader, false) >= 0)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	logger_cursor_out(reader);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -620,85 +695,201 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	return 0;
 }
 
+/*
+ * logger_get_log_len - returns the number of bytes 'reader' has not read
+ * yet, summed over all segments.
+ *
+ * Caller must hold reader->mutex.
+ */
+static long logger_get_log_len(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	long len = 0;
+	int i;
+
+	for (i = 0; i < log->nr_segs; i++) {
+		struct logger_segment *seg = &log->segs[i];
+
+		spin_lock(&seg->lock);
+		if (reader->r_pos[i] < seg->head)
+			reader->r_pos[i] = seg->head;
+		len += seg->tail - reader->r_pos[i];
+		spin_unlock(&seg->lock);
+	}
+
+	return len;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	int i;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		logger_cursor_in(reader);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
 		break;
 	case LOGGER_GET_LOG_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = logger_get_log_len(reader);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
-		else
-			ret = 0;
+		ret = get_next_entry_len(reader);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers find themselves behind 'head' and catch up */
+		for (i = 0; i < log->nr_segs; i++) {
+			spin_lock(&log->segs[i].lock);
+			log->segs[i].head = log->segs[i].tail;
+			logger_publish_head(log, &log->segs[i]);
+			spin_unlock(&log->segs[i].lock);
+		}
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
 	case LOGGER_SET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!reader) {
+			ret = -EBADF;
+			break;
+		}
+		reader->batch = !!arg;
+		ret = 0;
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader) {
+		logger_cursor_out(reader);
+		mutex_unlock(&reader->mutex);
+	}
 
 	return ret;
 }
 
+/*
+ * logger_buffer_pfn - the page frame of a log buffer address
+ *
+ * The buffer is in the kernel image when the logger is built in, and in
+ * vmalloc'ed module space when it is a module.
+ */
+static unsigned long logger_buffer_pfn(void *addr)
+{
+	if (virt_addr_valid(addr))
+		return virt_to_phys(addr) >> PAGE_SHIFT;
+	return vmalloc_to_pfn(addr);
+}
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps either the segment state and the log itself, read-only, or the
+ * reader's cursor page. See logger.h for the layout. The mapping shows the
+ * entries of every uid, so it is limited to readers that may read them all.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	unsigned long data_pages;
+	unsigned long addr;
+	unsigned char *buf;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+	if (!reader->r_all)
+		return -EPERM;
+
+	data_pages = log->size >> PAGE_SHIFT;
+	if (vma->vm_pgoff == data_pages + 1) {
+		if (len != PAGE_SIZE || !(vma->vm_flags & VM_SHARED))
+			return -EINVAL;
+
+		mutex_lock(&reader->mutex);
+		if (!reader->cursor) {
+			reader->cursor = (__u32 *) get_zeroed_page(GFP_KERNEL);
+			if (!reader->cursor) {
+				mutex_unlock(&reader->mutex);
+				return -ENOMEM;
+			}
+			logger_cursor_out(reader);
+		}
+		mutex_unlock(&reader->mutex);
+
+		return remap_pfn_range(vma, vma->vm_start,
+				       virt_to_phys(reader->cursor) >> PAGE_SHIFT,
+				       PAGE_SIZE, vma->vm_page_prot);
+	}
+
+	if (vma->vm_pgoff != 0 || len > (data_pages + 1) << PAGE_SHIFT)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(log->ctl) >> PAGE_SHIFT,
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		return ret;
+
+	/*
+	 * When built as a module the log buffer lives in module space,
+	 * which is not physically contiguous, so map it a page at a time.
+	 */
+	for (addr = vma->vm_start + PAGE_SIZE, buf = log->buffer;
+	     addr < vma->vm_end; addr += PAGE_SIZE, buf += PAGE_SIZE) {
+		ret = remap_pfn_range(vma, addr, logger_buffer_pfn(buf),
+				      PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -711,7 +902,7 @@ static const struct file_operations logger_fops = {
  * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -721,10 +912,6 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
 	.size = SIZE, \
 };
 
@@ -746,19 +933,69 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * init_segments - with CONFIG_ANDROID_LOGGER_PER_CPU, splits 'log' into one
+ * segment per possible cpu, rounded down to a power of two and to no fewer
+ * than LOGGER_MIN_SEGMENT_SIZE bytes per segment. Cpus share segments when
+ * there are fewer segments than cpus. Otherwise the log is a single segment,
+ * so that any writer can use all of it.
+ */
+static int __init init_segments(struct logger_log *log)
+{
+	int i;
+
+	log->nr_segs = 1;
+#ifdef CONFIG_ANDROID_LOGGER_PER_CPU
+	log->nr_segs = rounddown_pow_of_two(num_possible_cpus());
+	while (log->nr_segs > 1 &&
+	       log->size / log->nr_segs < LOGGER_MIN_SEGMENT_SIZE)
+		log->nr_segs >>= 1;
+#endif
+	log->seg_size = log->size / log->nr_segs;
+
+	log->segs = kcalloc(log->nr_segs, sizeof(struct logger_segment),
+			    GFP_KERNEL);
+	if (!log->segs)
+		return -ENOMEM;
+
+	log->ctl = (struct logger_mmap_header *) get_zeroed_page(GFP_KERNEL);
+	if (!log->ctl) {
+		kfree(log->segs);
+		return -ENOMEM;
+	}
+	log->ctl->nr_segs = log->nr_segs;
+	log->ctl->seg_size = log->seg_size;
+
+	for (i = 0; i < log->nr_segs; i++) {
+		spin_lock_init(&log->segs[i].lock);
+		log->segs[i].buffer = log->buffer + i * log->seg_size;
+	}
+
+	return 0;
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	ret = init_segments(log);
+	if (unlikely(ret)) {
+		printk(KERN_ERR "logger: failed to allocate segments "
+		       "for log '%s'!\n", log->misc.name);
+		return ret;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		free_page((unsigned long) log->ctl);
+		kfree(log->segs);
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	printk(KERN_INFO "logger: created %luK log '%s' in %d segments\n",
+	       (unsigned long) log->size >> 10, log->misc.name, log->nr_segs);
 
 	return 0;
 }
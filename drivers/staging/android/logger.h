@@ -58,6 +58,39 @@ struct logger_entry {
 
 #define LOGGER_ENTRY_MAX_PAYLOAD	4076
 
+/*
+ * A reader with access to all entries may mmap a log instead of reading it.
+ * Offset 0 maps, read-only, a page starting with struct logger_mmap_header
+ * followed by the log itself, split into nr_segs segments of seg_size bytes.
+ * nr_segs is 1 unless the kernel splits logs per cpu, in which case each
+ * segment only holds the history of the cpus that write to it.
+ * Entries are stored as struct logger_entry plus payload, and each segment is
+ * a ring ordered by time. Positions are byte counts that only grow, so they
+ * are taken modulo 2^32 here and modulo seg_size into the segment.
+ *
+ * Writers move head before they overwrite anything, and move tail only after
+ * the new entry is complete. A consumer copies an entry at pos < tail, then
+ * checks that head has not passed pos; if it has, the copy may be torn and
+ * the consumer continues at head. Merging the segments by entry timestamp is
+ * left to the consumer.
+ *
+ * The page at offset (1 + log size / page size) pages is the read cursor of
+ * the file, one __u32 position per segment, and has to be mapped shared. The
+ * driver uses it for read(), poll() and the ioctls, so a consumer that
+ * advances it after draining entries through the mapping can still poll() for
+ * new ones.
+ */
+struct logger_mmap_segment {
+	__u32		head;	/* position of the oldest entry */
+	__u32		tail;	/* position the next entry is written at */
+};
+
+struct logger_mmap_header {
+	__u32		nr_segs;	/* number of segments */
+	__u32		seg_size;	/* size of each segment */
+	struct logger_mmap_segment seg[0];
+};
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
@@ -66,5 +99,6 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) /* abi version */
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) /* abi version */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 7) /* whole entries */
 
 #endif /* _LINUX_LOGGER_H */
@@ -17,6 +17,19 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Candidates are kept in an index of user space processes bucketed by their
+ * oom_score_adj, which fork, exit, exec and oom_score_adj writes keep up to
+ * date, so picking a victim only looks at the highest non-empty bucket.
+ *
+ * With /sys/module/lowmemorykiller/parameters/use_pressure set, kills are
+ * driven by how hard reclaim has to work instead: every pressure_window
+ * pages scanned by reclaim make a sample, and the share of scanned pages that
+ * could not be reclaimed over the last few samples is the pressure, from 0 to
+ * 100. A kernel thread kills processes with a oom_score_adj value of adj[i]
+ * or higher when the pressure reaches pressure[i]. The minfree thresholds
+ * still apply as a floor. Kill counts and the current pressure are in
+ * /sys/kernel/mm/lowmemorykiller, and every kill is traced.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -34,10 +47,21 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/swap.h>
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
-#include <linux/profile.h>
-#include <linux/notifier.h>
+#include <linux/rculist_nulls.h>
+#include <linux/spinlock.h>
+#include <linux/bitops.h>
+#include <linux/lowmemorykiller.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -54,8 +78,61 @@ static int lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static int lowmem_pressure[6] = {
+	100,
+	95,
+	90,
+	80,
+};
+static int lowmem_pressure_size = 4;
+static uint32_t lowmem_use_pressure;
+static uint32_t lowmem_pressure_window = SWAP_CLUSTER_MAX * 16;
 
 static unsigned long lowmem_deathpending_timeout;
+static struct task_struct *lowmem_deathpending;
+
+/*
+ * The task index: one bucket per oom_score_adj value, and a bitmap of the
+ * buckets that are not empty. Lookups run under rcu_read_lock only. A task
+ * whose oom_score_adj changes moves to another bucket, so each bucket ends
+ * in its own nulls value and a lookup that got moved along restarts.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+
+static struct hlist_nulls_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static DECLARE_BITMAP(lowmem_bucket_map, LOWMEM_NR_BUCKETS);
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static bool lowmem_index_ready;
+
+/*
+ * Reclaim efficiency: the current window and the last few completed ones.
+ * Samples older than a second are too stale to say anything about the
+ * current pressure and are ignored.
+ */
+#define LOWMEM_PRESSURE_SAMPLES	4
+
+struct lowmem_pressure_sample {
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long stamp;
+};
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static unsigned long lowmem_window_scanned;
+static unsigned long lowmem_window_reclaimed;
+static struct lowmem_pressure_sample lowmem_samples[LOWMEM_PRESSURE_SAMPLES];
+static unsigned int lowmem_sample_next;
+
+static struct task_struct *lowmem_thread;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_thread_wait);
+static bool lowmem_thread_pending;
+
+/* serializes the shrinker and the thread when both may kill */
+static DEFINE_MUTEX(lowmem_kill_lock);
+
+static unsigned long lowmem_kill_count;
+static unsigned long lowmem_pressure_kill_count;
+static int lowmem_last_kill_pressure = -1;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -63,32 +140,314 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+/* caller holds lowmem_index_lock */
+static void __lowmem_index_add(struct task_struct *p)
+{
+	int bucket = p->signal->oom_score_adj - OOM_SCORE_ADJ_MIN;
+
+	p->lowmem_adj = p->signal->oom_score_adj;
+	hlist_nulls_add_head_rcu(&p->lowmem_node, &lowmem_buckets[bucket]);
+	__set_bit(bucket, lowmem_bucket_map);
+}
+
+/* caller holds lowmem_index_lock */
+static void __lowmem_index_del(struct task_struct *p)
+{
+	int bucket = p->lowmem_adj - OOM_SCORE_ADJ_MIN;
+
+	hlist_nulls_del_init_rcu(&p->lowmem_node);
+	if (hlist_nulls_empty(&lowmem_buckets[bucket]))
+		__clear_bit(bucket, lowmem_bucket_map);
+}
+
+void lowmem_task_add(struct task_struct *p)
+{
+	p->lowmem_node.pprev = NULL;
+	if (!lowmem_index_ready || (p->flags & PF_KTHREAD))
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	__lowmem_index_add(p);
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_task_del(struct task_struct *p)
+{
+	if (!lowmem_index_ready)
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	if (!hlist_nulls_unhashed(&p->lowmem_node))
+		__lowmem_index_del(p);
+	if (lowmem_deathpending == p)
+		lowmem_deathpending = NULL;
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_task_replace(struct task_struct *old, struct task_struct *new)
+{
+	lowmem_task_del(old);
+	lowmem_task_add(new);
+}
+
+void lowmem_task_adj_changed(struct task_struct *p)
+{
+	rcu_read_lock();
+	p = p->group_leader;
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready && !hlist_nulls_unhashed(&p->lowmem_node) &&
+	    p->lowmem_adj != p->signal->oom_score_adj) {
+		__lowmem_index_del(p);
+		__lowmem_index_add(p);
+	}
+	spin_unlock(&lowmem_index_lock);
+	rcu_read_unlock();
+}
+
+/*
+ * Picks the biggest process of the highest bucket at or above min_score_adj
+ * that still has memory. Returns the thread that holds the memory and sets
+ * *leader to the indexed task. Called under rcu_read_lock.
+ */
+static struct task_struct *lowmem_select(int min_score_adj,
+					 struct task_struct **leader,
+					 int *tasksize, int *oom_score_adj)
 {
-	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
-	int i;
-	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
-	int selected_oom_score_adj;
+	int bucket = LOWMEM_NR_BUCKETS;
+	int min_bucket = min_score_adj - OOM_SCORE_ADJ_MIN;
+
+	while (!selected) {
+		struct task_struct *tsk;
+		struct hlist_nulls_node *pos;
+		int next;
+
+		next = find_last_bit(lowmem_bucket_map, bucket);
+		if (next >= bucket || next < min_bucket)
+			break;
+		bucket = next;
+restart:
+		/* what a walk that had to restart picked may have moved */
+		selected = NULL;
+		*leader = NULL;
+		selected_tasksize = 0;
+		hlist_nulls_for_each_entry_rcu(tsk, pos,
+					       &lowmem_buckets[bucket],
+					       lowmem_node) {
+			struct task_struct *p;
+			int size;
+
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
+			size = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (size <= selected_tasksize)
+				continue;
+			selected = p;
+			*leader = tsk;
+			selected_tasksize = size;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm,
+				     bucket + OOM_SCORE_ADJ_MIN, size);
+		}
+		/* a task moved to another bucket while we were on it */
+		if (get_nulls_value(pos) != bucket)
+			goto restart;
+	}
+
+	*tasksize = selected_tasksize;
+	*oom_score_adj = bucket + OOM_SCORE_ADJ_MIN;
+	return selected;
+}
+
+/* caller holds lowmem_pressure_lock */
+static int __lowmem_pressure(void)
+{
+	unsigned long scanned = 0, reclaimed = 0;
+	int i;
+
+	for (i = 0; i < LOWMEM_PRESSURE_SAMPLES; i++) {
+		struct lowmem_pressure_sample *sample = &lowmem_samples[i];
+
+		if (!sample->scanned ||
+		    time_after(jiffies, sample->stamp + HZ))
+			continue;
+		scanned += sample->scanned;
+		reclaimed += sample->reclaimed;
+	}
+	if (!scanned)
+		return 0;
+	/* reclaimed can exceed scanned, e.g. with lumpy reclaim */
+	if (reclaimed >= scanned)
+		return 0;
+	return 100 - reclaimed * 100 / scanned;
+}
+
+static int lowmem_current_pressure(void)
+{
+	int pressure;
+
+	spin_lock(&lowmem_pressure_lock);
+	pressure = __lowmem_pressure();
+	spin_unlock(&lowmem_pressure_lock);
+	return pressure;
+}
+
+/* start over after a kill, the old samples do not apply anymore */
+static void lowmem_pressure_reset(void)
+{
+	spin_lock(&lowmem_pressure_lock);
+	memset(lowmem_samples, 0, sizeof(lowmem_samples));
+	lowmem_window_scanned = 0;
+	lowmem_window_reclaimed = 0;
+	spin_unlock(&lowmem_pressure_lock);
+}
+
+void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+		       unsigned long reclaimed)
+{
+	struct lowmem_pressure_sample *sample;
+	int pressure;
+
+	if (!lowmem_use_pressure || !scanned)
+		return;
+	/*
+	 * Allocations that cannot do I/O or use highmem and movable pages
+	 * say little about the pressure on the system as a whole.
+	 */
+	if (!(gfp_mask & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_window_scanned += scanned;
+	lowmem_window_reclaimed += reclaimed;
+	if (lowmem_window_scanned < lowmem_pressure_window) {
+		spin_unlock(&lowmem_pressure_lock);
+		return;
+	}
+	sample = &lowmem_samples[lowmem_sample_next];
+	lowmem_sample_next = (lowmem_sample_next + 1) % LOWMEM_PRESSURE_SAMPLES;
+	sample->scanned = lowmem_window_scanned;
+	sample->reclaimed = lowmem_window_reclaimed;
+	sample->stamp = jiffies;
+	lowmem_window_scanned = 0;
+	lowmem_window_reclaimed = 0;
+	pressure = __lowmem_pressure();
+	spin_unlock(&lowmem_pressure_lock);
+
+	trace_lowmem_pressure(sample->scanned, sample->reclaimed, pressure);
+
+	lowmem_thread_pending = true;
+	wake_up_interruptible(&lowmem_thread_wait);
+}
+
+static int lowmem_array_size(void)
+{
 	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free = global_page_state(NR_FREE_PAGES);
-	int other_file = global_page_state(NR_FILE_PAGES) -
-						global_page_state(NR_SHMEM);
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
+	return array_size;
+}
+
+static int lowmem_minfree_adj(int other_free, int other_file)
+{
+	int array_size = lowmem_array_size();
+	int i;
+
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_score_adj = lowmem_adj[i];
-			break;
-		}
+		    other_file < lowmem_minfree[i])
+			return lowmem_adj[i];
+	}
+	return OOM_SCORE_ADJ_MAX + 1;
+}
+
+static int lowmem_pressure_adj(int pressure)
+{
+	int array_size = lowmem_array_size();
+	int i;
+
+	if (lowmem_pressure_size < array_size)
+		array_size = lowmem_pressure_size;
+	for (i = 0; i < array_size; i++) {
+		if (pressure >= lowmem_pressure[i])
+			return lowmem_adj[i];
+	}
+	return OOM_SCORE_ADJ_MAX + 1;
+}
+
+/*
+ * Kills the biggest process at or above min_score_adj, unless the last
+ * process we killed is still dying or someone else is killing right now.
+ * pressure is -1 for a kill from the minfree thresholds. Returns the number
+ * of pages the process held, 0 if nothing was killed and -EAGAIN if a kill
+ * is still pending.
+ */
+static int lowmem_kill(int min_score_adj, int pressure, int other_free,
+		       int other_file)
+{
+	struct task_struct *selected;
+	struct task_struct *leader;
+	int selected_tasksize = 0;
+	int selected_oom_score_adj;
+
+	if (!mutex_trylock(&lowmem_kill_lock))
+		return -EAGAIN;
+	rcu_read_lock();
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		rcu_read_unlock();
+		mutex_unlock(&lowmem_kill_lock);
+		return -EAGAIN;
+	}
+
+	selected = lowmem_select(min_score_adj, &leader, &selected_tasksize,
+				 &selected_oom_score_adj);
+	if (selected) {
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d, "
+			     "pressure %d\n", selected->pid, selected->comm,
+			     selected_oom_score_adj, selected_tasksize,
+			     pressure);
+		trace_lowmem_kill(selected, selected_oom_score_adj,
+				  selected_tasksize, min_score_adj, pressure,
+				  other_free, other_file);
+		/* cleared when the process is unhashed */
+		spin_lock(&lowmem_index_lock);
+		if (!hlist_nulls_unhashed(&leader->lowmem_node))
+			lowmem_deathpending = leader;
+		spin_unlock(&lowmem_index_lock);
+		lowmem_deathpending_timeout = jiffies + HZ;
+		send_sig(SIGKILL, selected, 0);
+		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		lowmem_kill_count++;
+		if (pressure >= 0)
+			lowmem_pressure_kill_count++;
+		lowmem_last_kill_pressure = pressure;
 	}
+	rcu_read_unlock();
+	mutex_unlock(&lowmem_kill_lock);
+	return selected_tasksize;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int rem = 0;
+	int killed;
+	int min_score_adj;
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+
+	/* lowmem_thread makes the decisions in pressure mode */
+	if (lowmem_use_pressure)
+		min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+	else
+		min_score_adj = lowmem_minfree_adj(other_free, other_file);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 				sc->nr_to_scan, sc->gfp_mask, other_free,
@@ -102,61 +461,48 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_score_adj = min_score_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
+	killed = lowmem_kill(min_score_adj, -1, other_free, other_file);
+	if (killed < 0)
+		return 0;
+	rem -= killed;
+	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
+		     sc->nr_to_scan, sc->gfp_mask, rem);
+	return rem;
+}
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+static int lowmem_thread_fn(void *data)
+{
+	while (!kthread_should_stop()) {
+		int pressure, min_score_adj, adj;
+		int other_free, other_file;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
+		wait_event_interruptible(lowmem_thread_wait,
+					 lowmem_thread_pending ||
+					 kthread_should_stop());
+		lowmem_thread_pending = false;
+		if (!lowmem_use_pressure)
 			continue;
 
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
+		pressure = lowmem_current_pressure();
+		other_free = global_page_state(NR_FREE_PAGES);
+		other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+		min_score_adj = lowmem_pressure_adj(pressure);
+		adj = lowmem_minfree_adj(other_free, other_file);
+		if (adj < min_score_adj)
+			min_score_adj = adj;
+		lowmem_print(3, "lowmem_thread pressure %d, ofree %d %d, "
+			     "ma %d\n", pressure, other_free, other_file,
+			     min_score_adj);
+		if (min_score_adj == OOM_SCORE_ADJ_MAX + 1)
 			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_score_adj, tasksize);
-	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_score_adj, selected_tasksize);
-		lowmem_deathpending_timeout = jiffies + HZ;
-		send_sig(SIGKILL, selected, 0);
-		set_tsk_thread_flag(selected, TIF_MEMDIE);
-		rem -= selected_tasksize;
+
+		if (lowmem_kill(min_score_adj, pressure, other_free,
+				other_file) > 0)
+			lowmem_pressure_reset();
 	}
-	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
-		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
-	return rem;
+	return 0;
 }
 
 static struct shrinker lowmem_shrinker = {
@@ -164,8 +510,81 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+#ifdef CONFIG_SYSFS
+#define LOWMEM_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+
+static ssize_t kill_count_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", lowmem_kill_count);
+}
+LOWMEM_ATTR_RO(kill_count);
+
+static ssize_t pressure_kill_count_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", lowmem_pressure_kill_count);
+}
+LOWMEM_ATTR_RO(pressure_kill_count);
+
+static ssize_t last_kill_pressure_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lowmem_last_kill_pressure);
+}
+LOWMEM_ATTR_RO(last_kill_pressure);
+
+static ssize_t pressure_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lowmem_current_pressure());
+}
+LOWMEM_ATTR_RO(pressure);
+
+static struct attribute *lowmem_attrs[] = {
+	&kill_count_attr.attr,
+	&pressure_kill_count_attr.attr,
+	&last_kill_pressure_attr.attr,
+	&pressure_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lowmem_attr_group = {
+	.attrs = lowmem_attrs,
+	.name = "lowmemorykiller",
+};
+#endif /* CONFIG_SYSFS */
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		INIT_HLIST_NULLS_HEAD(&lowmem_buckets[i], i);
+
+	/* index the processes that were forked before us */
+	write_lock_irq(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	for_each_process(p)
+		if (!(p->flags & PF_KTHREAD))
+			__lowmem_index_add(p);
+	lowmem_index_ready = true;
+	spin_unlock(&lowmem_index_lock);
+	write_unlock_irq(&tasklist_lock);
+
+	lowmem_thread = kthread_run(lowmem_thread_fn, NULL, "lowmemorykiller");
+	if (IS_ERR(lowmem_thread)) {
+		printk(KERN_ERR "lowmemorykiller: creating kthread failed\n");
+		lowmem_thread = NULL;
+	}
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &lowmem_attr_group))
+		printk(KERN_ERR "lowmemorykiller: register sysfs failed\n");
+#endif
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -173,6 +592,11 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+#ifdef CONFIG_SYSFS
+	sysfs_remove_group(mm_kobj, &lowmem_attr_group);
+#endif
+	if (lowmem_thread)
+		kthread_stop(lowmem_thread);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -180,6 +604,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
+module_param_array_named(pressure, lowmem_pressure, int, &lowmem_pressure_size,
+			 S_IRUGO | S_IWUSR);
+module_param_named(use_pressure, lowmem_use_pressure, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, uint,
+		   S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
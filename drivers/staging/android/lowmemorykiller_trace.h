@@ -0,0 +1,105 @@
+/* lowmemorykiller_trace.h
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * lowmem_pressure - a reclaim window completed
+ * @scanned:	pages scanned in the window
+ * @reclaimed:	pages reclaimed in the window
+ * @pressure:	pressure over the whole sliding window, 0 to 100
+ */
+TRACE_EVENT(lowmem_pressure,
+
+	TP_PROTO(unsigned long scanned, unsigned long reclaimed, int pressure),
+
+	TP_ARGS(scanned, reclaimed, pressure),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, scanned)
+		__field(unsigned long, reclaimed)
+		__field(int, pressure)
+	),
+
+	TP_fast_assign(
+		__entry->scanned = scanned;
+		__entry->reclaimed = reclaimed;
+		__entry->pressure = pressure;
+	),
+
+	TP_printk("scanned=%lu reclaimed=%lu pressure=%d",
+		  __entry->scanned, __entry->reclaimed, __entry->pressure)
+);
+
+/**
+ * lowmem_kill - a process was sent SIGKILL
+ * @p:		the thread that holds the memory of the process
+ * @oom_score_adj: oom_score_adj of the process
+ * @tasksize:	rss of the process in pages
+ * @min_score_adj: the lowest oom_score_adj that could have been picked
+ * @pressure:	the pressure that triggered the kill, -1 for a minfree kill
+ * @other_free:	free pages at the time of the kill
+ * @other_file:	file pages at the time of the kill
+ */
+TRACE_EVENT(lowmem_kill,
+
+	TP_PROTO(struct task_struct *p, int oom_score_adj, int tasksize,
+		 int min_score_adj, int pressure, int other_free,
+		 int other_file),
+
+	TP_ARGS(p, oom_score_adj, tasksize, min_score_adj, pressure,
+		other_free, other_file),
+
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_score_adj)
+		__field(int, tasksize)
+		__field(int, min_score_adj)
+		__field(int, pressure)
+		__field(int, other_free)
+		__field(int, other_file)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid = p->pid;
+		__entry->oom_score_adj = oom_score_adj;
+		__entry->tasksize = tasksize;
+		__entry->min_score_adj = min_score_adj;
+		__entry->pressure = pressure;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+	),
+
+	TP_printk("comm=%s pid=%d adj=%d size=%d min_adj=%d pressure=%d "
+		  "free=%d file=%d",
+		  __entry->comm, __entry->pid, __entry->oom_score_adj,
+		  __entry->tasksize, __entry->min_score_adj,
+		  __entry->pressure, __entry->other_free,
+		  __entry->other_file)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,449 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/gfp.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/zlib.h>
+#include <net/netlink.h>
+#include <crypto/compress.h>
+
+#include "zram_comp.h"
+
+const char *zram_comp_default = "lzo";
+
+/* crypto_comp based backends: lzo, lz4, deflate */
+
+static int zram_crypto_create(struct zram_comp_stream *strm,
+			const char *crypto_name)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp(crypto_name, 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	strm->private = tfm;
+	return 0;
+}
+
+static void zram_crypto_destroy(struct zram_comp_stream *strm)
+{
+	crypto_free_comp(strm->private);
+}
+
+static int zram_crypto_compress(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len)
+{
+	int ret;
+	unsigned int dlen = 2 * PAGE_SIZE;
+
+	ret = crypto_comp_compress(strm->private, src, PAGE_SIZE,
+				strm->buffer, &dlen);
+	*dst_len = dlen;
+
+	return ret;
+}
+
+static int zram_crypto_decompress(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	int ret;
+	unsigned int dlen = PAGE_SIZE;
+
+	ret = crypto_comp_decompress(strm->private, src, src_len, dst, &dlen);
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+
+	return ret;
+}
+
+/*
+ * zlib-fast: raw deflate at Z_BEST_SPEED through the zlib pcomp
+ * interface, with a window just large enough for one page.
+ */
+#define ZRAM_ZLIB_WINDOWBITS	(-min_t(int, PAGE_SHIFT, MAX_WBITS))
+#define ZRAM_ZLIB_MEMLEVEL	8
+
+static int zram_zlib_create(struct zram_comp_stream *strm,
+			const char *crypto_name)
+{
+	struct {
+		struct nlattr nla;
+		int val;
+	} comp_params[] = {
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_COMP_LEVEL }, Z_BEST_SPEED },
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_COMP_METHOD }, Z_DEFLATED },
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_COMP_WINDOWBITS },
+			ZRAM_ZLIB_WINDOWBITS },
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_COMP_MEMLEVEL },
+			ZRAM_ZLIB_MEMLEVEL },
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_COMP_STRATEGY },
+			Z_DEFAULT_STRATEGY },
+	}, decomp_params[] = {
+		{ { NLA_HDRLEN + sizeof(int), ZLIB_DECOMP_WINDOWBITS },
+			ZRAM_ZLIB_WINDOWBITS },
+	};
+	struct crypto_pcomp *tfm;
+	int ret;
+
+	tfm = crypto_alloc_pcomp(crypto_name, 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	ret = crypto_compress_setup(tfm, comp_params, sizeof(comp_params));
+	if (!ret)
+		ret = crypto_decompress_setup(tfm, decomp_params,
+					sizeof(decomp_params));
+	if (ret) {
+		crypto_free_pcomp(tfm);
+		return ret;
+	}
+
+	strm->private = tfm;
+	return 0;
+}
+
+static void zram_zlib_destroy(struct zram_comp_stream *strm)
+{
+	crypto_free_pcomp(strm->private);
+}
+
+static int zram_zlib_compress(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len)
+{
+	int ret;
+	struct comp_request req;
+	struct crypto_pcomp *tfm = strm->private;
+
+	ret = crypto_compress_init(tfm);
+	if (ret)
+		return ret;
+
+	req.next_in = src;
+	req.avail_in = PAGE_SIZE;
+	req.next_out = strm->buffer;
+	req.avail_out = 2 * PAGE_SIZE;
+
+	ret = crypto_compress_update(tfm, &req);
+	if (ret < 0 && ret != -EAGAIN)
+		return ret;
+
+	ret = crypto_compress_final(tfm, &req);
+	if (ret < 0)
+		return ret;
+
+	*dst_len = 2 * PAGE_SIZE - req.avail_out;
+	return 0;
+}
+
+static int zram_zlib_decompress(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	int ret;
+	struct comp_request req;
+	struct crypto_pcomp *tfm = strm->private;
+
+	ret = crypto_decompress_init(tfm);
+	if (ret)
+		return ret;
+
+	req.next_in = src;
+	req.avail_in = src_len;
+	req.next_out = dst;
+	req.avail_out = PAGE_SIZE;
+
+	ret = crypto_decompress_update(tfm, &req);
+	if (ret < 0 && ret != -EAGAIN)
+		return ret;
+
+	ret = crypto_decompress_final(tfm, &req);
+	if (ret < 0)
+		return ret;
+
+	return req.avail_out ? -EINVAL : 0;
+}
+
+/*
+ * none: do not even try. Reporting a full page makes the write path
+ * store it uncompressed, so reads never reach ->decompress.
+ */
+static int zram_none_compress(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len)
+{
+	*dst_len = PAGE_SIZE;
+	return 0;
+}
+
+static const struct zram_comp_backend zram_comp_backends[] = {
+	{
+		.name		= "lzo",
+		.crypto_name	= "lzo",
+		.create		= zram_crypto_create,
+		.destroy	= zram_crypto_destroy,
+		.compress	= zram_crypto_compress,
+		.decompress	= zram_crypto_decompress,
+	}, {
+		.name		= "lz4",
+		.crypto_name	= "lz4",
+		.create		= zram_crypto_create,
+		.destroy	= zram_crypto_destroy,
+		.compress	= zram_crypto_compress,
+		.decompress	= zram_crypto_decompress,
+	}, {
+		.name		= "deflate",
+		.crypto_name	= "deflate",
+		.create		= zram_crypto_create,
+		.destroy	= zram_crypto_destroy,
+		.compress	= zram_crypto_compress,
+		.decompress	= zram_crypto_decompress,
+	}, {
+		.name		= "zlib-fast",
+		.crypto_name	= "zlib",
+		.create		= zram_zlib_create,
+		.destroy	= zram_zlib_destroy,
+		.compress	= zram_zlib_compress,
+		.decompress	= zram_zlib_decompress,
+	}, {
+		.name		= "none",
+		.compress	= zram_none_compress,
+	},
+};
+
+const struct zram_comp_backend *zram_comp_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zram_comp_backends); i++) {
+		if (sysfs_streq(name, zram_comp_backends[i].name))
+			return &zram_comp_backends[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * List the backends, with the current one in brackets. Backends whose
+ * crypto algorithm is neither built in nor loadable are left out.
+ */
+ssize_t zram_comp_available_show(const char *cur, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	const struct zram_comp_backend *backend;
+
+	for (i = 0; i < ARRAY_SIZE(zram_comp_backends); i++) {
+		backend = &zram_comp_backends[i];
+		if (backend->crypto_name &&
+				!crypto_has_alg(backend->crypto_name, 0, 0))
+			continue;
+
+		if (!strcmp(cur, backend->name))
+			sz += sprintf(buf + sz, "[%s] ", backend->name);
+		else
+			sz += sprintf(buf + sz, "%s ", backend->name);
+	}
+
+	if (sz)
+		sz--;
+	sz += sprintf(buf + sz, "\n");
+
+	return sz;
+}
+
+static void zram_comp_stream_free(struct zram_comp *comp,
+			struct zram_comp_stream *strm)
+{
+	if (strm->private)
+		comp->backend->destroy(strm);
+	free_pages((unsigned long)strm->buffer, 1);
+	kfree(strm);
+}
+
+/*
+ * Only called from process context (device init and max_comp_streams
+ * stores), never from the I/O path: the crypto API allocates the tfm
+ * context with GFP_KERNEL, which could recurse into swap.
+ */
+static struct zram_comp_stream *zram_comp_stream_alloc(struct zram_comp *comp)
+{
+	struct zram_comp_stream *strm;
+	const struct zram_comp_backend *backend = comp->backend;
+
+	strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+	if (!strm)
+		return NULL;
+
+	/*
+	 * Allocate 2 pages: 1 for compressed data, plus 1 extra for the
+	 * case when compressed size is larger than the original one.
+	 */
+	strm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!strm->buffer)
+		goto fail;
+
+	if (backend->create && backend->create(strm, backend->crypto_name))
+		goto fail;
+
+	INIT_LIST_HEAD(&strm->list);
+	return strm;
+
+fail:
+	zram_comp_stream_free(comp, strm);
+	return NULL;
+}
+
+/*
+ * Get an idle compression stream, sleeping until another user releases
+ * one if they are all busy.
+ */
+struct zram_comp_stream *zram_comp_stream_get(struct zram_comp *comp)
+{
+	struct zram_comp_stream *strm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			strm = list_first_entry(&comp->idle_strm,
+					struct zram_comp_stream, list);
+			list_del(&strm->list);
+			spin_unlock(&comp->strm_lock);
+			return strm;
+		}
+		spin_unlock(&comp->strm_lock);
+
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+void zram_comp_stream_put(struct zram_comp *comp,
+			struct zram_comp_stream *strm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&strm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* The limit was lowered while this stream was in use */
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zram_comp_stream_free(comp, strm);
+}
+
+/*
+ * Streams in use when the limit is lowered are freed as they are put.
+ * New streams are allocated right here, so that the I/O path never has
+ * to. If that fails the limit ends up at what could be allocated.
+ */
+void zram_comp_set_max_streams(struct zram_comp *comp, int max_strm)
+{
+	struct zram_comp_stream *strm;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = max_strm;
+	while (comp->avail_strm > max_strm &&
+			!list_empty(&comp->idle_strm)) {
+		strm = list_first_entry(&comp->idle_strm,
+				struct zram_comp_stream, list);
+		list_del(&strm->list);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zram_comp_stream_free(comp, strm);
+		spin_lock(&comp->strm_lock);
+	}
+
+	while (comp->avail_strm < comp->max_strm) {
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+		strm = zram_comp_stream_alloc(comp);
+		spin_lock(&comp->strm_lock);
+		if (!strm) {
+			comp->avail_strm--;
+			comp->max_strm = comp->avail_strm;
+			pr_warning("Only %d compression streams allocated\n",
+				comp->avail_strm);
+			break;
+		}
+		list_add(&strm->list, &comp->idle_strm);
+	}
+	spin_unlock(&comp->strm_lock);
+
+	wake_up(&comp->strm_wait);
+}
+
+int zram_comp_init(struct zram_comp *comp, const char *name, int max_strm)
+{
+	comp->backend = zram_comp_find(name);
+	if (!comp->backend) {
+		pr_err("Unknown compression algorithm: %s\n", name);
+		return -EINVAL;
+	}
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->avail_strm = 0;
+
+	zram_comp_set_max_streams(comp, max_strm < 1 ? 1 : max_strm);
+	if (!comp->avail_strm) {
+		pr_err("Error allocating %s compression stream\n", name);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Caller must make sure no stream is in use any more.
+ */
+void zram_comp_destroy(struct zram_comp *comp)
+{
+	struct zram_comp_stream *strm, *tmp;
+
+	/* Never initialized */
+	if (!comp->avail_strm)
+		return;
+
+	list_for_each_entry_safe(strm, tmp, &comp->idle_strm, list) {
+		list_del(&strm->list);
+		zram_comp_stream_free(comp, strm);
+	}
+	comp->avail_strm = 0;
+}
+
+int zram_comp_compress(struct zram_comp *comp, struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len)
+{
+	return comp->backend->compress(strm, src, dst_len);
+}
+
+int zram_comp_decompress(struct zram_comp *comp,
+			struct zram_comp_stream *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	return comp->backend->decompress(strm, src, src_len, dst);
+}
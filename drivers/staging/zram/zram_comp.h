@@ -0,0 +1,88 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+struct zram_comp_stream;
+
+/*
+ * Compression backend. Backends other than "none" are thin wrappers
+ * around crypto API compressors; their per-stream state (the tfm) lives
+ * in zram_comp_stream->private.
+ */
+struct zram_comp_backend {
+	const char *name;		/* as shown in comp_algorithm */
+	const char *crypto_name;	/* crypto API algorithm, if any */
+	int (*create)(struct zram_comp_stream *strm, const char *crypto_name);
+	void (*destroy)(struct zram_comp_stream *strm);
+	int (*compress)(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len);
+	int (*decompress)(struct zram_comp_stream *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+};
+
+/*
+ * A compression stream: the backend state and the output buffer
+ * needed for one page compression or decompression. A stream is owned
+ * by exactly one user at a time, so several writers compress in
+ * parallel as long as there are enough streams.
+ */
+struct zram_comp_stream {
+	void *private;
+	void *buffer;		/* compressed data, 2 pages */
+	struct list_head list;
+};
+
+/*
+ * Bounded pool of compression streams. All max_strm streams are
+ * allocated up front, from process context, so the I/O path never
+ * allocates; users wait for an idle stream when they are all busy.
+ */
+struct zram_comp {
+	const struct zram_comp_backend *backend;
+	spinlock_t strm_lock;		/* protects idle_strm, avail_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;			/* streams allocated */
+	int max_strm;
+};
+
+extern const char *zram_comp_default;
+
+const struct zram_comp_backend *zram_comp_find(const char *name);
+ssize_t zram_comp_available_show(const char *cur, char *buf);
+
+int zram_comp_init(struct zram_comp *comp, const char *name, int max_strm);
+void zram_comp_destroy(struct zram_comp *comp);
+void zram_comp_set_max_streams(struct zram_comp *comp, int max_strm);
+
+struct zram_comp_stream *zram_comp_stream_get(struct zram_comp *comp);
+void zram_comp_stream_put(struct zram_comp *comp,
+			struct zram_comp_stream *strm);
+
+int zram_comp_compress(struct zram_comp *comp, struct zram_comp_stream *strm,
+			const unsigned char *src, size_t *dst_len);
+int zram_comp_decompress(struct zram_comp *comp,
+			struct zram_comp_stream *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+
+#endif
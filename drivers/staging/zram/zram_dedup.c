@@ -0,0 +1,205 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+static struct kmem_cache *zram_dedup_cache;
+
+int zram_dedup_cache_create(void)
+{
+	zram_dedup_cache = kmem_cache_create("zram_dedup",
+				sizeof(struct zram_dedup_entry), 0, 0, NULL);
+
+	return zram_dedup_cache ? 0 : -ENOMEM;
+}
+
+void zram_dedup_cache_destroy(void)
+{
+	kmem_cache_destroy(zram_dedup_cache);
+}
+
+int zram_dedup_init(struct zram *zram)
+{
+	int i;
+
+	zram->dedup = kcalloc(ZRAM_DEDUP_BUCKETS, sizeof(*zram->dedup),
+				GFP_KERNEL);
+	if (!zram->dedup)
+		return -ENOMEM;
+
+	for (i = 0; i < ZRAM_DEDUP_BUCKETS; i++) {
+		spin_lock_init(&zram->dedup[i].lock);
+		zram->dedup[i].root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+/*
+ * All entries must have been released already (see zram_reset_device).
+ */
+void zram_dedup_destroy(struct zram *zram)
+{
+	kfree(zram->dedup);
+	zram->dedup = NULL;
+}
+
+u32 zram_dedup_checksum(const void *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+static struct zram_dedup_bucket *zram_dedup_bucket(struct zram *zram,
+			u32 checksum)
+{
+	return &zram->dedup[checksum % ZRAM_DEDUP_BUCKETS];
+}
+
+static int zram_dedup_match(struct zram *zram, struct zram_dedup_entry *entry,
+			const void *mem, size_t len)
+{
+	int match;
+	unsigned char *cmem;
+
+	if (entry->len != len)
+		return 0;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(cmem + sizeof(struct zobj_header), mem, len);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for a stored object with the same compressed contents and take
+ * a reference to it.
+ */
+struct zram_dedup_entry *zram_dedup_get(struct zram *zram, const void *mem,
+			size_t len, u32 checksum)
+{
+	struct zram_dedup_bucket *bucket = zram_dedup_bucket(zram, checksum);
+	struct zram_dedup_entry *entry, *found = NULL;
+	struct rb_node *rb_node;
+
+	spin_lock(&bucket->lock);
+	rb_node = bucket->root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_dedup_entry, rb_node);
+		if (checksum < entry->checksum) {
+			rb_node = rb_node->rb_left;
+		} else if (checksum > entry->checksum) {
+			rb_node = rb_node->rb_right;
+		} else {
+			/* Equal checksums: scan all of them */
+			while ((rb_node = rb_prev(&entry->rb_node))) {
+				struct zram_dedup_entry *prev = rb_entry(
+					rb_node, struct zram_dedup_entry,
+					rb_node);
+				if (prev->checksum != checksum)
+					break;
+				entry = prev;
+			}
+
+			for (rb_node = &entry->rb_node; rb_node;
+					rb_node = rb_next(rb_node)) {
+				entry = rb_entry(rb_node,
+					struct zram_dedup_entry, rb_node);
+				if (entry->checksum != checksum)
+					break;
+				if (zram_dedup_match(zram, entry, mem, len)) {
+					entry->refcount++;
+					found = entry;
+					break;
+				}
+			}
+			break;
+		}
+	}
+	spin_unlock(&bucket->lock);
+
+	return found;
+}
+
+/*
+ * Index a newly stored object so that later writes can share it.
+ * Returns NULL if the entry cannot be allocated; the object is then
+ * simply stored without being shared.
+ */
+struct zram_dedup_entry *zram_dedup_add(struct zram *zram,
+			unsigned long handle, size_t len, u32 checksum)
+{
+	struct zram_dedup_bucket *bucket = zram_dedup_bucket(zram, checksum);
+	struct zram_dedup_entry *entry, *cur;
+	struct rb_node **p, *parent = NULL;
+
+	entry = kmem_cache_alloc(zram_dedup_cache, GFP_NOIO | __GFP_NOWARN);
+	if (!entry)
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->refcount = 1;
+	entry->handle = handle;
+	entry->len = len;
+
+	spin_lock(&bucket->lock);
+	p = &bucket->root.rb_node;
+	while (*p) {
+		parent = *p;
+		cur = rb_entry(parent, struct zram_dedup_entry, rb_node);
+		if (checksum < cur->checksum)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, p);
+	rb_insert_color(&entry->rb_node, &bucket->root);
+	spin_unlock(&bucket->lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference. Returns 1 if this was the last one: the entry is
+ * then unlinked and the caller frees the object and the entry.
+ */
+int zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	struct zram_dedup_bucket *bucket;
+	int last;
+
+	bucket = zram_dedup_bucket(zram, entry->checksum);
+
+	spin_lock(&bucket->lock);
+	last = !--entry->refcount;
+	if (last)
+		rb_erase(&entry->rb_node, &bucket->root);
+	spin_unlock(&bucket->lock);
+
+	return last;
+}
+
+void zram_dedup_free(struct zram_dedup_entry *entry)
+{
+	kmem_cache_free(zram_dedup_cache, entry);
+}
@@ -0,0 +1,58 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct zram;
+
+/*
+ * A compressed object that may be shared by several table entries.
+ * Entries are indexed by a checksum of the compressed data; objects
+ * with equal checksums are compared byte by byte before being shared.
+ */
+struct zram_dedup_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	u32 refcount;		/* protected by the bucket lock */
+	unsigned long handle;	/* zsmalloc object */
+	u16 len;		/* compressed size */
+};
+
+struct zram_dedup_bucket {
+	spinlock_t lock;
+	struct rb_root root;
+};
+
+#define ZRAM_DEDUP_BUCKETS	64
+
+int zram_dedup_cache_create(void);
+void zram_dedup_cache_destroy(void);
+
+int zram_dedup_init(struct zram *zram);
+void zram_dedup_destroy(struct zram *zram);
+
+u32 zram_dedup_checksum(const void *mem, size_t len);
+struct zram_dedup_entry *zram_dedup_get(struct zram *zram, const void *mem,
+			size_t len, u32 checksum);
+struct zram_dedup_entry *zram_dedup_add(struct zram *zram,
+			unsigned long handle, size_t len, u32 checksum);
+int zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry);
+void zram_dedup_free(struct zram_dedup_entry *entry);
+
+#endif
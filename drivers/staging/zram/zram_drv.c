@@ -23,15 +23,16 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -39,17 +40,20 @@
 static int zram_major;
 struct zram *devices;
 
+/* Backing device reads, see zram_read_from_bdev() */
+static struct workqueue_struct *zram_wb_wq;
+
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,21 +93,208 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Table entries are protected by a per-slot bit spinlock, so writers
+ * to different slots only serialize inside the allocator.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+/*
+ * Check if the page is filled with one repeated word (most often zero).
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+/*
+ * Resolve the compressed object of a slot, which may be shared.
+ */
+static void zram_slot_object(struct zram *zram, u32 index,
+				unsigned long *handle, size_t *size)
+{
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		*handle = zram->table[index].entry->handle;
+		*size = zram->table[index].entry->len;
+	} else {
+		*handle = zram->table[index].handle;
+		*size = zram->table[index].size;
+	}
+}
+
+/*
+ * Backing device blocks are page sized. Returns the first of nr
+ * consecutive free blocks, or ULONG_MAX if there is no such range.
+ */
+static unsigned long zram_alloc_blocks(struct zram *zram, int nr)
+{
+	unsigned long block;
+
+	spin_lock(&zram->bitmap_lock);
+	block = bitmap_find_next_zero_area(zram->bitmap, zram->nr_blocks,
+					0, nr, 0);
+	if (block >= zram->nr_blocks)
+		block = ULONG_MAX;
+	else
+		bitmap_set(zram->bitmap, block, nr);
+	spin_unlock(&zram->bitmap_lock);
+
+	return block;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->bitmap_lock);
+	if (zram->bd_readers) {
+		set_bit(block, zram->deferred);
+		zram->nr_deferred++;
+	} else {
+		clear_bit(block, zram->bitmap);
+	}
+	spin_unlock(&zram->bitmap_lock);
+}
+
+/*
+ * A backing device read cannot hold the slot lock, so a slot can be
+ * freed while its block is being read. Blocks freed while any read is
+ * in flight are only released once the last read is done, so such a
+ * block cannot be rewritten under the reader.
+ */
+static void zram_pin_blocks(struct zram *zram)
+{
+	spin_lock(&zram->bitmap_lock);
+	zram->bd_readers++;
+	spin_unlock(&zram->bitmap_lock);
+}
+
+static void zram_unpin_blocks(struct zram *zram)
+{
+	spin_lock(&zram->bitmap_lock);
+	if (!--zram->bd_readers && zram->nr_deferred) {
+		bitmap_andnot(zram->bitmap, zram->bitmap, zram->deferred,
+				zram->nr_blocks);
+		bitmap_zero(zram->deferred, zram->nr_blocks);
+		zram->nr_deferred = 0;
+	}
+	spin_unlock(&zram->bitmap_lock);
+}
+
+struct zram_bio_wait {
+	struct completion done;
+	int error;
+};
+
+static void zram_bdev_end_io(struct bio *bio, int error)
+{
+	struct zram_bio_wait *wait = bio->bi_private;
+
+	if (!error && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		error = -EIO;
+	wait->error = error;
+	complete(&wait->done);
+}
+
+/*
+ * Synchronously transfer nr pages to or from consecutive blocks of the
+ * backing device, using as few bios as the queue limits allow.
+ */
+static int zram_bdev_rw(struct zram *zram, struct page **pages, int nr,
+			unsigned long block, int rw)
+{
+	int i, done = 0;
+	struct bio *bio;
+	struct zram_bio_wait wait;
+
+	while (done < nr) {
+		bio = bio_alloc(GFP_NOIO, nr - done);
+		if (!bio)
+			return -ENOMEM;
+
+		bio->bi_bdev = zram->backing_dev;
+		bio->bi_sector = (block + done) << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_end_io = zram_bdev_end_io;
+		bio->bi_private = &wait;
+
+		for (i = done; i < nr; i++) {
+			if (bio_add_page(bio, pages[i], PAGE_SIZE, 0) !=
+					PAGE_SIZE)
+				break;
+		}
+		if (i == done) {
+			bio_put(bio);
+			return -EIO;
+		}
+
+		init_completion(&wait.done);
+		submit_bio(rw, bio);
+		wait_for_completion(&wait.done);
+		bio_put(bio);
+
+		if (wait.error)
+			return wait.error;
+		done = i;
+	}
+
+	return 0;
+}
+
+struct zram_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int ret;
+};
+
+static void zram_read_work_fn(struct work_struct *work)
+{
+	struct zram_read_work *rw;
+
+	rw = container_of(work, struct zram_read_work, work);
+	rw->ret = zram_bdev_rw(rw->zram, &rw->page, 1, rw->block, READ_SYNC);
+}
+
+/*
+ * Bios submitted from within make_request are only issued once it
+ * returns, so waiting for one here would deadlock. Do the read from a
+ * worker instead. The workqueue has a rescuer, since this may be a
+ * swap-in under memory pressure.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long block)
+{
+	struct zram_read_work rw;
+
+	rw.zram = zram;
+	rw.page = page;
+	rw.block = block;
+	INIT_WORK_ONSTACK(&rw.work, zram_read_work_fn);
+	queue_work(zram_wb_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	return rw.ret;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,39 +324,71 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/*
+ * Called with the slot lock held.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_block(zram, zram->table[index].block);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram->table[index].block = 0;
+		zram_stat_dec(&zram->stats.bd_count);
+		return;
+	}
 
-	if (unlikely(!page)) {
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
 		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
+		 * No memory is allocated for same filled pages.
+		 * Simply clear the flag and the stored pattern.
 		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+		if (zram->table[index].element)
+			zram_stat_dec(&zram->stats.pages_same);
+		else
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!zram->table[index].handle))
+		return;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		struct zram_dedup_entry *entry = zram->table[index].entry;
+
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		clen = entry->len;
+		if (clen <= PAGE_SIZE / 2)
+			zram_stat_dec(&zram->stats.good_compress);
+
+		if (!zram_dedup_put(zram, entry)) {
+			/* Still used by other slots */
+			zram_stat_dec(&zram->stats.pages_dup);
+			zram_stat_dec(&zram->stats.pages_stored);
+			goto clear;
+		}
+
+		zs_free(zram->mem_pool, entry->handle);
+		zram_dedup_free(entry);
+		goto out;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
+	zs_free(zram->mem_pool, zram->table[index].handle);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
@@ -173,16 +396,25 @@ out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
 	void *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		unsigned long *p = user_mem;
+		unsigned int pos;
+
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*p); pos++)
+			p[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -194,12 +426,11 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
@@ -210,30 +441,72 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_comp_stream *strm = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		size_t obj_size;
+		unsigned long handle;
 		struct page *page;
 		struct zobj_header *zheader;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
+retry:
+		zram_slot_lock(zram, index);
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			unsigned long block = zram->table[index].block;
+			int stale;
+
+			/*
+			 * The read sleeps, so the slot lock is dropped for it.
+			 * If the slot was freed or rewritten meanwhile, what
+			 * was read is stale: look at the slot again.
+			 */
+			zram_pin_blocks(zram);
+			zram_slot_unlock(zram, index);
+			ret = zram_read_from_bdev(zram, page, block);
+			zram_slot_lock(zram, index);
+			stale = !zram_test_flag(zram, index, ZRAM_WB) ||
+				zram->table[index].block != block;
+			zram_slot_unlock(zram, index);
+			zram_unpin_blocks(zram);
+			if (stale)
+				goto retry;
+
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram, &zram->stats.failed_reads);
+				goto out;
+			}
+			zram_stat64_inc(zram, &zram->stats.bd_reads);
+			flush_dcache_page(page);
+			index++;
+			continue;
+		}
+
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			unsigned long element = zram->table[index].element;
+
+			zram_slot_unlock(zram, index);
+			handle_same_page(page, element);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!zram->table[index].handle)) {
+			zram_slot_unlock(zram, index);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
+			handle_same_page(page, 0);
 			index++;
 			continue;
 		}
@@ -241,26 +514,40 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			zram_slot_unlock(zram, index);
 			index++;
 			continue;
 		}
 
+		/*
+		 * Backends may keep decompression state, so decompressing
+		 * needs a stream. Getting one may sleep, so drop the slot
+		 * lock and look at the slot again once we have it.
+		 */
+		if (!strm) {
+			zram_slot_unlock(zram, index);
+			strm = zram_comp_stream_get(&zram->comp);
+			goto retry;
+		}
+
+		zram_slot_object(zram, index, &handle, &obj_size);
+
 		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		ret = zram_comp_decompress(&zram->comp, strm,
+			cmem + sizeof(*zheader), obj_size, user_mem);
 
+		zs_unmap_object(zram->mem_pool, handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+
+		zram_slot_unlock(zram, index);
+		zram_comp_stream_put(&zram->comp, strm);
+		strm = NULL;
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -271,129 +558,192 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+	/* The slot may have changed while we were waiting for a stream */
+	if (strm)
+		zram_comp_stream_put(&zram->comp, strm);
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+	if (strm)
+		zram_comp_stream_put(&zram->comp, strm);
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Compression and allocation are done without any zram lock held, so
+ * writers on different CPUs proceed in parallel. The slot lock is only
+ * taken to swap the new object into the table.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
-
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	int ret;
+	size_t clen;
+	u32 checksum = 0;
+	int uncompressed = 0;
+	unsigned long element;
+	unsigned long handle = 0;
+	struct zobj_header *zheader;
+	struct page *page_store = NULL;
+	struct zram_dedup_entry *entry = NULL;
+	struct zram_comp_stream *strm;
+	unsigned char *user_mem, *cmem, *src;
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
 
 		/*
 		 * System overwrites unused sectors. Free memory associated
 		 * with this sector now.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram->table[index].element = element;
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram_slot_unlock(zram, index);
+
+		if (element)
+			zram_stat_inc(&zram->stats.pages_same);
+		else
+			zram_stat_inc(&zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		mutex_lock(&zram->lock);
+	strm = zram_comp_stream_get(&zram->comp);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zram_comp_compress(&zram->comp, strm, user_mem, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	if (unlikely(ret)) {
+		zram_comp_stream_put(&zram->comp, strm);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
+	/* Share an identical object if one is already stored */
+	if (zram->dedup && clen <= max_zpage_size) {
+		checksum = zram_dedup_checksum(strm->buffer, clen);
+		entry = zram_dedup_get(zram, strm->buffer, clen, checksum);
+		if (entry) {
+			zram_comp_stream_put(&zram->comp, strm);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+			zram_slot_lock(zram, index);
+			zram_free_page(zram, index);
+			zram->table[index].entry = entry;
+			zram_set_flag(zram, index, ZRAM_DEDUP);
+			zram_slot_unlock(zram, index);
+
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat_inc(&zram->stats.pages_dup);
+			zram_stat_inc(&zram->stats.pages_stored);
+			if (clen <= PAGE_SIZE / 2)
+				zram_stat_inc(&zram->stats.good_compress);
+			return 0;
 		}
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_comp_stream_put(&zram->comp, strm);
+		strm = NULL;
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			return -ENOMEM;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		uncompressed = 1;
+	} else {
+		handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader),
+				GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!handle)) {
+			zram_comp_stream_put(&zram->comp, strm);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+			return -ENOMEM;
 		}
+	}
 
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	if (uncompressed) {
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+	} else {
+		src = strm->buffer;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	}
 
 #if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
+	/* Back-reference needed for memory defragmentation */
+	if (!uncompressed) {
+		zheader = (struct zobj_header *)cmem;
+		zheader->table_idx = index;
+		cmem += sizeof(*zheader);
+	}
 #endif
 
-		memcpy(cmem, src, clen);
+	memcpy(cmem, src, clen);
 
+	if (uncompressed) {
 		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		kunmap_atomic(src, KM_USER0);
+	} else {
+		zs_unmap_object(zram->mem_pool, handle);
+		zram_comp_stream_put(&zram->comp, strm);
+	}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	if (zram->dedup && !uncompressed)
+		entry = zram_dedup_add(zram, handle, clen, checksum);
+
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	if (entry) {
+		zram->table[index].entry = entry;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else if (uncompressed) {
+		zram->table[index].page = page_store;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+	} else {
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+	}
+	zram_slot_unlock(zram, index);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (uncompressed)
+		zram_stat_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
+	return 0;
+}
+
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
 		index++;
 	}
 
@@ -458,42 +808,54 @@ void zram_reset_device(struct zram *zram)
 	size_t index;
 
 	mutex_lock(&zram->init_lock);
+	/* Wait for a writeback in progress */
+	mutex_lock(&zram->wb_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams */
+	zram_comp_destroy(&zram->comp);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		unsigned long handle = zram->table[index].handle;
 
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+			struct zram_dedup_entry *entry = zram->table[index].entry;
+
+			if (zram_dedup_put(zram, entry)) {
+				zs_free(zram->mem_pool, entry->handle);
+				zram_dedup_free(entry);
+			}
+		} else if (unlikely(zram_test_flag(zram, index,
+						ZRAM_UNCOMPRESSED))) {
+			__free_page(zram->table[index].page);
+		} else {
+			zs_free(zram->mem_pool, handle);
+		}
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_destroy(zram);
+
+	/* The backing device stays attached, but its contents are gone */
+	if (zram->bitmap)
+		bitmap_zero(zram->bitmap, zram->nr_blocks);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
 	zram->disksize = 0;
+	mutex_unlock(&zram->wb_lock);
 	mutex_unlock(&zram->init_lock);
 }
 
@@ -511,19 +873,13 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
+	if (!zram->max_comp_streams)
+		zram->max_comp_streams = num_online_cpus();
 
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_comp_init(&zram->comp, zram->compressor,
+			zram->max_comp_streams);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -540,13 +896,21 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		ret = zram_dedup_init(zram);
+		if (ret) {
+			pr_err("Error allocating dedup index\n");
+			goto fail;
+		}
+	}
+
 	zram->init_done = 1;
 	mutex_unlock(&zram->init_lock);
 
@@ -561,12 +925,302 @@ fail:
 	return ret;
 }
 
+static void zram_close_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->backing_dev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	kfree(zram->bitmap);
+	kfree(zram->deferred);
+	kfree(zram->backing_dev_name);
+	zram->backing_dev = NULL;
+	zram->bitmap = NULL;
+	zram->deferred = NULL;
+	zram->backing_dev_name = NULL;
+	zram->nr_blocks = 0;
+}
+
+/*
+ * Attach the block device at path as backing store for writeback, or
+ * detach the current one if path is empty. Only possible before the
+ * device is initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret = 0;
+	char *name = NULL;
+	unsigned long *bitmap, *deferred;
+	unsigned long nr_blocks;
+	struct block_device *bdev;
+
+	mutex_lock(&zram->init_lock);
+
+	if (zram->init_done) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!*path) {
+		zram_close_backing_dev(zram);
+		goto out;
+	}
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = kcalloc(BITS_TO_LONGS(nr_blocks), sizeof(long), GFP_KERNEL);
+	deferred = kcalloc(BITS_TO_LONGS(nr_blocks), sizeof(long), GFP_KERNEL);
+	if (!nr_blocks || !bitmap || !deferred) {
+		kfree(bitmap);
+		kfree(deferred);
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		ret = nr_blocks ? -ENOMEM : -EINVAL;
+		goto out;
+	}
+
+	zram_close_backing_dev(zram);
+	zram->backing_dev = bdev;
+	zram->backing_dev_name = name;
+	zram->bitmap = bitmap;
+	zram->deferred = deferred;
+	zram->nr_blocks = nr_blocks;
+	name = NULL;
+
+	pr_info("Using %s as backing device (%lu blocks)\n", path, nr_blocks);
+
+out:
+	kfree(name);
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+/*
+ * Mark every stored page idle. Pages read after this lose the mark, so
+ * a later ZRAM_WB_IDLE writeback only picks up pages that were not
+ * accessed in between.
+ */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done)
+		goto out;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		zram_slot_lock(zram, index);
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+	}
+
+out:
+	mutex_unlock(&zram->init_lock);
+}
+
+#define ZRAM_WB_BATCH	32
+
+/*
+ * Copy the uncompressed contents of slot index into page if it is a
+ * writeback candidate for mode, and mark it ZRAM_UNDER_WB. Any write or
+ * free of the slot clears that flag, which tells zram_wb_flush() the
+ * copy went stale.
+ */
+static int zram_wb_prepare(struct zram *zram, size_t index, int mode,
+			struct page *page)
+{
+	int ret = 0;
+	size_t clen;
+	unsigned long handle;
+	unsigned char *user_mem, *cmem;
+	struct zram_comp_stream *strm = NULL;
+
+retry:
+	zram_slot_lock(zram, index);
+
+	if (!zram->table[index].handle ||
+			zram_test_flag(zram, index, ZRAM_SAME) ||
+			zram_test_flag(zram, index, ZRAM_DEDUP) ||
+			zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		goto out;
+
+	if ((mode & ZRAM_WB_HUGE) &&
+			!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		goto out;
+
+	if ((mode & ZRAM_WB_IDLE) &&
+			!zram_test_flag(zram, index, ZRAM_IDLE))
+		goto out;
+
+	/* Getting a stream may sleep, see zram_read() */
+	if (!strm && !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		zram_slot_unlock(zram, index);
+		strm = zram_comp_stream_get(&zram->comp);
+		goto retry;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+		memcpy(user_mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		ret = 1;
+	} else {
+		zram_slot_object(zram, index, &handle, &clen);
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+		ret = !zram_comp_decompress(&zram->comp, strm,
+				cmem + sizeof(struct zobj_header), clen,
+				user_mem);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (ret)
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+out:
+	zram_slot_unlock(zram, index);
+	if (strm)
+		zram_comp_stream_put(&zram->comp, strm);
+	return ret;
+}
+
+/*
+ * Write a batch of prepared pages to consecutive backing device blocks
+ * and switch the slots that were not modified meanwhile over to them.
+ * If no run of nr free blocks is left, the batch is split.
+ */
+static int zram_wb_flush(struct zram *zram, struct page **pages,
+			size_t *indices, int nr)
+{
+	int i, ret, half;
+	size_t index;
+	unsigned long block;
+
+	block = zram_alloc_blocks(zram, nr);
+	if (block == ULONG_MAX) {
+		if (nr == 1) {
+			zram_slot_lock(zram, indices[0]);
+			zram_clear_flag(zram, indices[0], ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, indices[0]);
+			return -ENOSPC;
+		}
+
+		half = nr / 2;
+		ret = zram_wb_flush(zram, pages, indices, half);
+		if (!ret)
+			return zram_wb_flush(zram, pages + half,
+					indices + half, nr - half);
+
+		for (i = half; i < nr; i++) {
+			zram_slot_lock(zram, indices[i]);
+			zram_clear_flag(zram, indices[i], ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, indices[i]);
+		}
+		return ret;
+	}
+
+	ret = zram_bdev_rw(zram, pages, nr, block, WRITE);
+
+	for (i = 0; i < nr; i++) {
+		index = indices[i];
+
+		zram_slot_lock(zram, index);
+		if (!ret && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].block = block + i;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat_inc(&zram->stats.bd_count);
+			zram_slot_unlock(zram, index);
+			zram_stat64_inc(zram, &zram->stats.bd_writes);
+			continue;
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+		zram_free_block(zram, block + i);
+	}
+
+	return ret;
+}
+
+/*
+ * Move stored pages selected by mode (ZRAM_WB_HUGE, ZRAM_WB_IDLE) out
+ * to the backing device, in batches of ZRAM_WB_BATCH pages.
+ *
+ * Only wb_lock is held across the backing device I/O: it keeps a reset
+ * from freeing the table under us without blocking the sysfs handlers
+ * that take init_lock.
+ */
+int zram_writeback(struct zram *zram, int mode)
+{
+	int i, nr = 0, ret = 0;
+	size_t index, num_pages;
+	size_t indices[ZRAM_WB_BATCH];
+	struct page *pages[ZRAM_WB_BATCH];
+
+	mutex_lock(&zram->init_lock);
+
+	if (!zram->init_done || !zram->backing_dev) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	mutex_lock(&zram->wb_lock);
+	mutex_unlock(&zram->init_lock);
+
+	memset(pages, 0, sizeof(pages));
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages; index++) {
+		if (zram_wb_prepare(zram, index, mode, pages[nr]))
+			indices[nr++] = index;
+
+		if (nr == ZRAM_WB_BATCH || (nr && index == num_pages - 1)) {
+			ret = zram_wb_flush(zram, pages, indices, nr);
+			nr = 0;
+			if (ret)
+				break;
+		}
+		cond_resched();
+	}
+
+out_free:
+	for (i = 0; i < ZRAM_WB_BATCH && pages[i]; i++)
+		__free_page(pages[i]);
+	mutex_unlock(&zram->wb_lock);
+	return ret;
+}
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1233,11 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
+	mutex_init(&zram->wb_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->bitmap_lock);
+	zram->compressor = zram_comp_default;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1320,24 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_dedup_cache_create();
+	if (ret) {
+		pr_warning("Unable to create dedup cache\n");
+		goto out;
+	}
+
+	zram_wb_wq = alloc_workqueue("zram_wb", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!zram_wb_wq) {
+		pr_warning("Unable to create writeback workqueue\n");
+		ret = -ENOMEM;
+		goto destroy_cache;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_wq;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1367,10 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+destroy_wq:
+	destroy_workqueue(zram_wb_wq);
+destroy_cache:
+	zram_dedup_cache_destroy();
 out:
 	return ret;
 }
@@ -713,9 +1386,12 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_close_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_wb_wq);
+	zram_dedup_cache_destroy();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -18,7 +18,9 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zram_comp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -51,8 +53,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -68,8 +70,23 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is filled with a repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* Object may be shared, table.entry points to its dedup entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device, at table.block */
+	ZRAM_WB,
+
+	/* Page is being written back, still valid in memory */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since the last "idle" trigger */
+	ZRAM_IDLE,
+
+	/* Slot lock, taken with bit_spin_lock() */
+	ZRAM_ACCESS,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -78,10 +95,16 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		unsigned long handle;		/* zsmalloc object */
+		struct page *page;		/* ZRAM_UNCOMPRESSED */
+		struct zram_dedup_entry *entry;	/* ZRAM_DEDUP */
+		unsigned long element;		/* ZRAM_SAME */
+		unsigned long block;		/* ZRAM_WB */
+	};
+	u16 size;	/* compressed object size */
 	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	unsigned long flags;	/* word sized for bit_spin_lock() */
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -92,20 +115,34 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* writes that shared a stored object */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written back */
+	atomic_t pages_zero;		/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of other pattern filled pages */
+	atomic_t pages_dup;	/* no. of pages sharing another's object */
+	atomic_t bd_count;	/* no. of pages on the backing device */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
-	struct table *table;
+	struct zs_pool *mem_pool;
+	struct zram_comp comp;	/* compression streams */
+	struct table *table;	/* entries protected by ZRAM_ACCESS */
+	struct zram_dedup_bucket *dedup;	/* NULL if dedup is off */
+	/* Optional backing device for writeback, one page per block */
+	struct block_device *backing_dev;
+	char *backing_dev_name;
+	unsigned long *bitmap;		/* allocated blocks */
+	unsigned long *deferred;	/* freed while reads were pinning */
+	unsigned long nr_blocks;
+	int bd_readers;			/* reads pinning freed blocks */
+	int nr_deferred;
+	spinlock_t bitmap_lock;		/* protects the above */
+	struct mutex wb_lock;		/* held by writeback, taken by reset */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +153,9 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;
+	const char *compressor;	/* backend name, see zram_comp.c */
+	int use_dedup;
 
 	struct zram_stats stats;
 };
@@ -129,4 +169,12 @@ extern struct attribute_group zram_disk_attr_group;
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
+/* Writeback modes */
+#define ZRAM_WB_HUGE	1	/* incompressible pages */
+#define ZRAM_WB_IDLE	2	/* pages marked idle */
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, int mode);
+
 #endif
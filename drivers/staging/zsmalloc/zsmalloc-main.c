@@ -0,0 +1,833 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped by size class into zspages. A zspage is a set of
+ * up to ZS_MAX_PAGES_PER_ZSPAGE pages, chosen per class so that little
+ * space is left over at its end; objects may straddle the pages of a
+ * zspage and are then accessed through a per-cpu bounce buffer.
+ *
+ * Users refer to objects through opaque handles, which stay valid when
+ * compaction moves the object to another zspage of its class. Mapping
+ * an object pins its handle, and pinned objects are never moved.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *handle_cachep;
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static unsigned long cache_alloc_handle(gfp_t flags)
+{
+	return (unsigned long)kmem_cache_alloc(handle_cachep,
+			flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+}
+
+static void cache_free_handle(unsigned long handle)
+{
+	kmem_cache_free(handle_cachep, (void *)handle);
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> OBJ_TAG_BITS;
+}
+
+/*
+ * Leaves the pin bit as it is: compaction updates the handle of an
+ * object it moves while holding the pin.
+ */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *p = (unsigned long *)handle;
+
+	*p = (obj << OBJ_TAG_BITS) | (*p & (1UL << HANDLE_PIN_BIT));
+}
+
+static struct zspage *get_zspage(struct page *page)
+{
+	return (struct zspage *)page_private(page);
+}
+
+static unsigned long location_to_obj(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static void obj_to_location(unsigned long obj, struct zspage **zspage,
+				unsigned int *idx)
+{
+	*zspage = get_zspage(pfn_to_page(obj >> OBJ_INDEX_BITS));
+	*idx = obj & OBJ_INDEX_MASK;
+}
+
+/*
+ * Page holding the start of object idx, and the offset within it.
+ */
+static struct page *obj_page_offset(struct zspage *zspage, unsigned int idx,
+				unsigned long *offset)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+
+	*offset = off & ~PAGE_MASK;
+	return zspage->pages[off >> PAGE_SHIFT];
+}
+
+static unsigned long read_obj_head(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long offset, head;
+	struct page *page;
+	void *vaddr;
+
+	page = obj_page_offset(zspage, idx, &offset);
+	vaddr = kmap_atomic(page, KM_USER0);
+	head = *(unsigned long *)(vaddr + offset);
+	kunmap_atomic(vaddr, KM_USER0);
+
+	return head;
+}
+
+static void write_obj_head(struct zspage *zspage, unsigned int idx,
+				unsigned long head)
+{
+	unsigned long offset;
+	struct page *page;
+	void *vaddr;
+
+	page = obj_page_offset(zspage, idx, &offset);
+	vaddr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(vaddr + offset) = head;
+	kunmap_atomic(vaddr, KM_USER0);
+}
+
+static int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Number of pages per zspage that wastes the least space at its end.
+ * For example, 3 objects of 1360 bytes leave 16 bytes unused in one
+ * page, but 3 objects of 1376 bytes leave 2720 of 8192 bytes unused in
+ * two pages, against 32 of 12288 in three.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size, waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	if (!zspage->inuse)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * 4 <= class->objs_per_zspage *
+				ZS_ALMOST_FULL_QUARTERS)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+			enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+}
+
+/*
+ * Move a zspage to the list matching its current usage. Returns the
+ * new group; a zspage that became empty is on no list and must be
+ * released by the caller.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	remove_zspage(class, zspage);
+	insert_zspage(class, zspage, newfg);
+
+	return newfg;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < ZS_FULL; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+/*
+ * Allocate a zspage with all objects free, linked in index order.
+ */
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~(__GFP_HIGHMEM |
+						__GFP_MOVABLE));
+	if (!zspage)
+		return NULL;
+
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+	INIT_LIST_HEAD(&zspage->list);
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(flags);
+
+		if (!page) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++)
+		write_obj_head(zspage, i, (i + 1UL) << OBJ_TAG_BITS);
+	zspage->freeobj = 0;
+
+	return zspage;
+}
+
+static unsigned long obj_malloc(struct size_class *class,
+			struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->freeobj;
+
+	zspage->freeobj = read_obj_head(zspage, idx) >> OBJ_TAG_BITS;
+	write_obj_head(zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return location_to_obj(zspage, idx);
+}
+
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct zspage *zspage;
+	unsigned int idx;
+
+	obj_to_location(obj, &zspage, &idx);
+	write_obj_head(zspage, idx,
+			(unsigned long)zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/*
+ * Copy len bytes starting at byte off of a zspage to or from buf.
+ * The range crosses at most one page boundary.
+ */
+static void zs_copy_obj(struct zspage *zspage, unsigned long off,
+			char *buf, int len, int to_obj)
+{
+	int n;
+	void *vaddr;
+	struct page *page;
+
+	while (len) {
+		page = zspage->pages[off >> PAGE_SHIFT];
+		n = min_t(int, len, PAGE_SIZE - (off & ~PAGE_MASK));
+
+		vaddr = kmap_atomic(page, KM_USER0);
+		if (to_obj)
+			memcpy(vaddr + (off & ~PAGE_MASK), buf, n);
+		else
+			memcpy(buf, vaddr + (off & ~PAGE_MASK), n);
+		kunmap_atomic(vaddr, KM_USER0);
+
+		off += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Pages that could be released if the objects of a class were packed
+ * into as few zspages as possible.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+/*
+ * Move one object into dst. Returns 0 if the object is pinned.
+ */
+static int migrate_obj(struct size_class *class, struct zspage *src,
+			unsigned int idx, struct zspage *dst)
+{
+	unsigned long handle, old_obj, new_obj, from, to;
+	unsigned int new_idx;
+	int len, n;
+	void *s_addr, *d_addr;
+
+	handle = read_obj_head(src, idx) & ~OBJ_ALLOCATED_TAG;
+	if (!trypin_tag(handle))
+		return 0;
+
+	old_obj = location_to_obj(src, idx);
+	new_obj = obj_malloc(class, dst, handle);
+	new_idx = new_obj & OBJ_INDEX_MASK;
+
+	/* The handle word was set up by obj_malloc() */
+	from = (unsigned long)idx * class->size + ZS_HANDLE_SIZE;
+	to = (unsigned long)new_idx * class->size + ZS_HANDLE_SIZE;
+	for (len = class->size - ZS_HANDLE_SIZE; len; len -= n) {
+		n = min_t(int, len, PAGE_SIZE - (from & ~PAGE_MASK));
+		n = min_t(int, n, PAGE_SIZE - (to & ~PAGE_MASK));
+
+		s_addr = kmap_atomic(src->pages[from >> PAGE_SHIFT], KM_USER0);
+		d_addr = kmap_atomic(dst->pages[to >> PAGE_SHIFT], KM_USER1);
+		memcpy(d_addr + (to & ~PAGE_MASK),
+			s_addr + (from & ~PAGE_MASK), n);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		from += n;
+		to += n;
+	}
+
+	record_obj(handle, new_obj);
+	obj_free(class, old_obj);
+	unpin_tag(handle);
+
+	return 1;
+}
+
+/*
+ * Empty the zspages of a class that are least used into the ones that
+ * are most used. Returns the number of pages released.
+ */
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned int idx;
+	unsigned long freed = 0;
+	struct zspage *src, *dst;
+	enum fullness_group fullness;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		struct list_head *head;
+
+		head = &class->fullness_list[ZS_ALMOST_EMPTY];
+		if (list_empty(head))
+			break;
+
+		src = list_entry(head->prev, struct zspage, list);
+		remove_zspage(class, src);
+		src->fullness = ZS_EMPTY;
+
+		for (idx = 0; idx < class->objs_per_zspage && src->inuse;
+				idx++) {
+			if (!(read_obj_head(src, idx) & OBJ_ALLOCATED_TAG))
+				continue;
+
+			dst = find_get_zspage(class);
+			if (!dst)
+				break;
+			if (!migrate_obj(class, src, idx, dst))
+				continue;
+			fix_fullness_group(class, dst);
+		}
+
+		fullness = get_fullness_group(class, src);
+		insert_zspage(class, src, fullness);
+		if (fullness != ZS_EMPTY) {
+			/* Pinned objects left behind, try again later */
+			break;
+		}
+
+		class->zspages--;
+		spin_unlock(&class->lock);
+
+		free_zspage(class, src);
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		freed += class->pages_per_zspage;
+		cond_resched();
+
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Release partially used zspages of a pool
+ * @pool: pool to compact
+ *
+ * Objects that are mapped at the time are skipped. Returns the number
+ * of pages released.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+	struct size_class *class;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		class = pool->size_class[i];
+		if (!class || class->index != i)
+			continue;
+		freed += __zs_compact(pool, class);
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static int zs_shrinker_scan(struct shrinker *shrinker,
+			struct shrink_control *sc)
+{
+	int i;
+	unsigned long freeable = 0;
+	struct size_class *class;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = pool->size_class[i];
+		if (!class || class->index != i)
+			continue;
+		spin_lock(&class->lock);
+		freeable += zs_can_compact(class);
+		spin_unlock(&class->lock);
+	}
+
+	return min_t(unsigned long, freeable, INT_MAX);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i;
+	struct zs_pool *pool;
+	struct size_class *prev_class = NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	/*
+	 * Walk from the largest size down, so that a run of sizes with
+	 * the same geometry shares the class of its largest member.
+	 */
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		int j, size, pages_per_zspage, objs_per_zspage;
+		struct size_class *class;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_ALLOC_SIZE)
+			size = ZS_MAX_ALLOC_SIZE;
+		pages_per_zspage = get_pages_per_zspage(size);
+		objs_per_zspage = pages_per_zspage * PAGE_SIZE / size;
+
+		if (prev_class &&
+				prev_class->pages_per_zspage == pages_per_zspage &&
+				prev_class->objs_per_zspage == objs_per_zspage) {
+			pool->size_class[i] = prev_class;
+			prev_class->index = i;
+			continue;
+		}
+
+		class = kzalloc(sizeof(*class), GFP_KERNEL);
+		if (!class) {
+			zs_destroy_pool(pool);
+			return NULL;
+		}
+
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+		class->size = size;
+		class->pages_per_zspage = pages_per_zspage;
+		class->objs_per_zspage = objs_per_zspage;
+		class->index = i;
+
+		pool->size_class[i] = class;
+		prev_class = class;
+	}
+
+	pool->shrinker.shrink = zs_shrinker_scan;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	if (pool->shrinker.shrink)
+		unregister_shrinker(&pool->shrinker);
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		int fg;
+		struct zspage *zspage, *tmp;
+		struct size_class *class = pool->size_class[i];
+
+		/* Shared classes are freed through their lowest slot */
+		if (!class || class->index != i)
+			continue;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (list_empty(&class->fullness_list[fg]))
+				continue;
+
+			pr_info("Freeing non-empty class with size %db, "
+				"fullness group %d\n", class->size, fg);
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list)
+				free_zspage(class, zspage);
+		}
+		kfree(class);
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: flags for the handle and any new zspage
+ *
+ * On success, a handle to the allocated object is returned, otherwise
+ * 0. The object is accessed with zs_map_object().
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = cache_alloc_handle(flags);
+	if (!handle)
+		return 0;
+
+	*(unsigned long *)handle = 0;
+
+	size += ZS_HANDLE_SIZE;
+	class = pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage)) {
+			cache_free_handle(handle);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj = obj_malloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	record_obj(handle, obj);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned long obj;
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keeps compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &zspage, &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, obj);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	if (fullness == ZS_EMPTY) {
+		free_zspage(class, zspage);
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+	}
+
+	cache_free_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object is going to be accessed
+ *
+ * The object stays in place until zs_unmap_object() is called. Only
+ * one object can be mapped per CPU at a time, and the caller must not
+ * sleep while it is mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned long obj, off;
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+	struct page *page;
+	char *ret;
+
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &zspage, &idx);
+	class = zspage->class;
+	page = obj_page_offset(zspage, idx, &off);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (off + class->size <= PAGE_SIZE) {
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		ret = area->vm_addr + off;
+	} else {
+		if (mm != ZS_MM_WO)
+			zs_copy_obj(zspage, (unsigned long)idx * class->size,
+					area->vm_buf, class->size, 0);
+		ret = area->vm_buf;
+	}
+
+	return ret + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned long obj, off;
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &zspage, &idx);
+	class = zspage->class;
+	obj_page_offset(zspage, idx, &off);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (off + class->size <= PAGE_SIZE) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		/* Copy back, skipping the handle word we did not hand out */
+		zs_copy_obj(zspage, (unsigned long)idx * class->size +
+				ZS_HANDLE_SIZE, area->vm_buf + ZS_HANDLE_SIZE,
+				class->size - ZS_HANDLE_SIZE, 1);
+	}
+	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+	struct size_class *class;
+
+	stats->total_size = zs_get_total_size_bytes(pool);
+	stats->used_size = 0;
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = pool->size_class[i];
+		if (!class || class->index != i)
+			continue;
+		spin_lock(&class->lock);
+		stats->used_size += (u64)class->objs_inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+		per_cpu(zs_map_area, cpu).vm_buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	BUILD_BUG_ON(ZS_MAX_OBJS_PER_ZSPAGE > OBJ_INDEX_MASK);
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			goto fail;
+	}
+
+	handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!handle_cachep)
+		goto fail;
+
+	return 0;
+
+fail:
+	zs_free_map_areas();
+	return -ENOMEM;
+}
+
+static void __exit zs_exit(void)
+{
+	kmem_cache_destroy(handle_cachep);
+	zs_free_map_areas();
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
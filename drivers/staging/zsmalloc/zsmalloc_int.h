@@ -0,0 +1,128 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * Every allocated object starts with a word holding its handle, so
+ * that compaction can find and update the handle of an object it
+ * moves. Free objects use the same word to link the free list.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes, which is
+ * 16 for 4k pages. Class sizes stay multiples of 16 (of 8 at least),
+ * so the handle word of an object never crosses a page boundary.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		(DIV_ROUND_UP(ZS_MAX_ALLOC_SIZE - \
+				ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA) + 1)
+
+/*
+ * A zspage is a group of up to this many 0-order pages holding objects
+ * of one size class. Using more than one page lets objects span page
+ * boundaries, which keeps the tail waste of large classes low.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / \
+				ZS_MIN_ALLOC_SIZE)
+
+/*
+ * Object location: <PFN of the first zspage page, object index>,
+ * shifted left by OBJ_TAG_BITS. In a handle the tag bit is the pin
+ * bit; in the handle word of an object it marks the object allocated.
+ */
+#ifndef MAX_PHYSMEM_BITS
+#define MAX_PHYSMEM_BITS	BITS_PER_LONG
+#endif
+#define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
+#define OBJ_TAG_BITS		1
+#define OBJ_INDEX_BITS		(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+#define HANDLE_PIN_BIT		0
+#define OBJ_ALLOCATED_TAG	1
+
+/*
+ * A zspage is almost empty when no more than this many quarters of
+ * its objects are in use. Almost empty zspages are compaction sources;
+ * allocation prefers almost full ones.
+ */
+#define ZS_ALMOST_FULL_QUARTERS	3
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,	/* on no list, released right away */
+};
+
+struct size_class;
+
+/*
+ * Each page of a zspage points to the zspage through page->private.
+ */
+struct zspage {
+	struct list_head list;		/* on class->fullness_list */
+	struct size_class *class;
+	enum fullness_group fullness;
+	unsigned int inuse;		/* allocated objects */
+	unsigned int freeobj;		/* first free object index */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, handle included */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	unsigned int index;		/* first pool->size_class[] slot */
+
+	/* Stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+struct zs_pool {
+	/*
+	 * Neighbouring sizes that end up with the same zspage geometry
+	 * share one size_class, which packs their objects together.
+	 */
+	struct size_class *size_class[ZS_SIZE_CLASSES];
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+
+	struct shrinker shrinker;
+};
+
+/*
+ * Per-cpu state of the object currently mapped with zs_map_object().
+ */
+struct mapping_area {
+	char *vm_buf;			/* copy of an object spanning pages */
+	char *vm_addr;			/* kmap address of a single page */
+	enum zs_mapmode vm_mm;
+};
+
+#endif
@@ -25,11 +25,13 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
+#include <linux/percpu.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
 #include "decompressor.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * This file (and decompressor.h) implements a decompressor framework for
@@ -77,34 +79,147 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+/*
+ * Read decompressor specific options from file system if present
+ */
+static void *squashfs_read_comp_opts(struct super_block *sb,
+	unsigned short flags, int *length)
+{
+	struct squashfs_page_actor actor;
+	void *buffer;
+
+	*length = 0;
+	if (!SQUASHFS_COMP_OPTS(flags))
+		return NULL;
+
+	buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+	if (buffer == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	squashfs_page_actor_init(&actor, &buffer, 1);
+	*length = squashfs_read_data(sb, &actor,
+		sizeof(struct squashfs_super_block), 0, NULL,
+		PAGE_CACHE_SIZE);
+
+	if (*length < 0) {
+		kfree(buffer);
+		return ERR_PTR(*length);
+	}
+
+	return buffer;
+}
+
+
+static int squashfs_stream_init(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream, void *comp_opts, int length)
+{
+	mutex_init(&stream->mutex);
+	stream->stream = msblk->decompressor->init(msblk, comp_opts, length);
+	if (IS_ERR(stream->stream)) {
+		int err = PTR_ERR(stream->stream);
+
+		stream->stream = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Set up the decompressor streams of a filesystem being mounted.  By default
+ * there is a single stream, and all decompression is serialised on it.  If
+ * percpu is set every possible cpu gets a stream of its own, so that readers
+ * on different cpus decompress in parallel, at the cost of a decompressor
+ * workspace (the block size or more) per cpu.
+ */
+int squashfs_decompressor_create(struct super_block *sb, unsigned short flags,
+	int percpu)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
-
-	/*
-	 * Read decompressor specific options from file system if present
-	 */
-	if (SQUASHFS_COMP_OPTS(flags)) {
-		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
-		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
-
-		length = squashfs_read_data(sb, &buffer,
-			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
-
-		if (length < 0) {
-			strm = ERR_PTR(length);
+	void *comp_opts;
+	int length, cpu, err = 0;
+
+	comp_opts = squashfs_read_comp_opts(sb, flags, &length);
+	if (IS_ERR(comp_opts))
+		return PTR_ERR(comp_opts);
+
+	if (percpu) {
+		msblk->percpu_stream = alloc_percpu(struct squashfs_stream);
+		if (msblk->percpu_stream == NULL) {
+			err = -ENOMEM;
+			goto finished;
+		}
+
+		for_each_possible_cpu(cpu) {
+			err = squashfs_stream_init(msblk,
+				per_cpu_ptr(msblk->percpu_stream, cpu),
+				comp_opts, length);
+			if (err)
+				break;
+		}
+	} else {
+		msblk->stream = kmalloc(sizeof(*msblk->stream), GFP_KERNEL);
+		if (msblk->stream == NULL) {
+			err = -ENOMEM;
 			goto finished;
 		}
+
+		err = squashfs_stream_init(msblk, msblk->stream, comp_opts,
+			length);
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	if (err)
+		squashfs_decompressor_destroy(msblk);
 
 finished:
-	kfree(buffer);
+	kfree(comp_opts);
+
+	return err;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	int cpu;
+
+	if (msblk->percpu_stream) {
+		for_each_possible_cpu(cpu)
+			msblk->decompressor->free(per_cpu_ptr(
+				msblk->percpu_stream, cpu)->stream);
+		free_percpu(msblk->percpu_stream);
+		msblk->percpu_stream = NULL;
+	}
+
+	if (msblk->stream) {
+		msblk->decompressor->free(msblk->stream->stream);
+		kfree(msblk->stream);
+		msblk->stream = NULL;
+	}
+}
+
+
+/*
+ * Decompress using the stream of the current cpu, or the only stream.  The
+ * stream is not pinned to the cpu: the caller may sleep waiting for buffers
+ * and be migrated, so the stream is still locked, but with per-cpu streams
+ * the mutex is almost never contended.
+ */
+int squashfs_decompress(struct squashfs_sb_info *msblk,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	int res;
+
+	if (msblk->percpu_stream)
+		stream = per_cpu_ptr(msblk->percpu_stream,
+			raw_smp_processor_id());
+
+	mutex_lock(&stream->mutex);
+	res = msblk->decompressor->decompress(msblk, stream->stream, output,
+		bh, b, offset, length, srclength);
+	mutex_unlock(&stream->mutex);
 
-	return strm;
+	return res;
 }
@@ -47,6 +47,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -409,6 +410,18 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+#ifdef CONFIG_SQUASHFS_FILE_DIRECT
+			/*
+			 * Try to decompress the datablock straight into the
+			 * page cache, falling back to the read_page cache if
+			 * its pages are busy.
+			 */
+			int res = squashfs_readpage_direct(page, block, bsize);
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+#endif
 			/*
 			 * Read and decompress datablock.
 			 */
@@ -496,6 +509,118 @@ out:
 }
 
 
+/*
+ * Start reading the compressed datablocks [first, last] of a file from disk
+ * in one go.  They are stored back to back, so this is a single sequential
+ * read, and while readpage decompresses one block the following ones are
+ * still in flight.  squashfs_read_data() finds the buffers locked or already
+ * uptodate and only waits for them.
+ */
+static void squashfs_prefetch_datablocks(struct inode *inode, int first,
+	int last)
+{
+	struct super_block *sb = inode->i_sb;
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	struct buffer_head *bh[SQUASHFS_PREFETCH_BH];
+	u64 block, start = 0, end = 0, cur, last_cur;
+	int i, n, bsize;
+
+	for (i = first; i <= last; i++) {
+		/* the tail end of the file may be packed in a fragment */
+		if (i >= file_end && squashfs_i(inode)->fragment_block !=
+					SQUASHFS_INVALID_BLK)
+			break;
+
+		bsize = read_blocklist(inode, i, &block);
+		if (bsize < 0)
+			return;
+		if (bsize == 0) /* hole */
+			continue;
+
+		if (end == 0)
+			start = block;
+		end = block + SQUASHFS_COMPRESSED_SIZE_BLOCK(bsize);
+	}
+
+	if (end <= start)
+		return;
+
+	TRACE("Prefetching blocks %d-%d, 0x%llx-0x%llx\n", first, last,
+		start, end);
+
+	cur = start >> msblk->devblksize_log2;
+	last_cur = (end - 1) >> msblk->devblksize_log2;
+	while (cur <= last_cur) {
+		for (n = 0; n < SQUASHFS_PREFETCH_BH && cur <= last_cur; cur++) {
+			bh[n] = sb_getblk(sb, cur);
+			if (bh[n])
+				n++;
+		}
+		ll_rw_block(READ, n, bh);
+		while (n--)
+			put_bh(bh[n]);
+	}
+}
+
+
+/*
+ * Readahead.  The I/O for all the datablocks in the readahead window is
+ * submitted first, then each block is read by squashfs_readpage() on its
+ * first page.  The other pages of the block are added to the page cache
+ * unlocked, so that readpage can grab and fill them together with the first
+ * one, and the PG_readahead marker set on one of them is kept.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int first, last;
+
+	/* the pages are on the list in ascending index order from the tail */
+	first = list_entry(pages->prev, struct page, lru)->index >> shift;
+	last = list_entry(pages->next, struct page, lru)->index >> shift;
+	if (last > first)
+		squashfs_prefetch_datablocks(inode, first, last);
+
+	while (!list_empty(pages)) {
+		struct page *page, *target = NULL;
+		int index = list_entry(pages->prev, struct page, lru)->index
+			>> shift;
+
+		while (!list_empty(pages)) {
+			page = list_entry(pages->prev, struct page, lru);
+			if (page->index >> shift != index)
+				break;
+
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+					GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+
+			if (target == NULL) {
+				target = page;
+				continue;
+			}
+			unlock_page(page);
+			page_cache_release(page);
+		}
+
+		if (target) {
+			squashfs_readpage(file, target);
+			page_cache_release(target);
+		}
+	}
+
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
@@ -0,0 +1,129 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * file_direct.c
+ */
+
+/*
+ * This file implements reading a datablock straight into the page cache.
+ *
+ * The normal readpage path decompresses a datablock into the read_page
+ * cache and then copies it out into every page cache page the block covers.
+ * Here all of those pages are grabbed and locked first, and the block is
+ * decompressed into them directly, which saves copying the whole block and
+ * does not wait on the read_page cache.
+ *
+ * Pages are only grabbed with grab_cache_page_nowait().  If one of them is
+ * locked by someone else (usually another reader of the same block), is
+ * already uptodate or cannot be allocated, -EAGAIN is returned without
+ * touching anything, and the caller falls back to the read_page cache.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "page_actor.h"
+
+/*
+ * Read the datablock <block> of compressed size <bsize> into the pages it
+ * covers, one of which is the locked <target_page>.  Returns 0 once all
+ * pages are uptodate and unlocked, -EAGAIN if the pages could not be
+ * grabbed, or another error with <target_page> still locked.
+ */
+int squashfs_readpage_direct(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int i, n, pages, res = -EAGAIN;
+	struct squashfs_page_actor actor;
+	struct page **page;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kcalloc(pages, sizeof(*page), GFP_KERNEL);
+	if (page == NULL)
+		goto out;
+
+	/*
+	 * A page that is already uptodate may be mapped and read while we
+	 * would be decompressing into it, so leave such blocks to the
+	 * read_page cache as well.
+	 */
+	for (i = 0, n = start_index; n <= end_index; i++, n++) {
+		page[i] = n == target_page->index ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+		if (page[i] == NULL)
+			goto release_pages;
+		if (PageUptodate(page[i]) && page[i] != target_page) {
+			i++;
+			goto release_pages;
+		}
+	}
+
+	/* the decompressor kmaps the pages one at a time as it fills them */
+	squashfs_page_actor_init_pages(&actor, page, pages);
+	res = squashfs_read_data(inode->i_sb, &actor, block, bsize, NULL,
+		msblk->block_size);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto release_pages;
+	}
+
+	for (i = 0; i < pages; i++) {
+		int avail = clamp_t(int, res - i * PAGE_CACHE_SIZE, 0,
+			PAGE_CACHE_SIZE);
+
+		if (avail < PAGE_CACHE_SIZE)
+			zero_user_segment(page[i], avail, PAGE_CACHE_SIZE);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+
+	res = 0;
+	goto out;
+
+release_pages:
+	for (n = 0; n < i; n++) {
+		if (page[n] != target_page) {
+			unlock_page(page[n]);
+			page_cache_release(page[n]);
+		}
+	}
+
+out:
+	kfree(page);
+	return res;
+}
@@ -0,0 +1,78 @@
+#ifndef PAGE_ACTOR_H
+#define PAGE_ACTOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * page_actor.h
+ */
+
+#include <linux/highmem.h>
+
+/*
+ * Where squashfs_read_data() puts a block, one PAGE_CACHE_SIZE buffer at
+ * a time.  The buffers are either already mapped (the caches and tables),
+ * or page cache pages that are only kmapped while they are being filled,
+ * so that a reader never holds more than one kmap.
+ */
+struct squashfs_page_actor {
+	void		**buffer;	/* mapped buffers, or NULL */
+	struct page	**page;		/* pages to kmap, if no buffers */
+	void		*pageaddr;	/* the buffer being filled */
+	int		pages;
+	int		next_page;
+};
+
+static inline void squashfs_page_actor_init(struct squashfs_page_actor *actor,
+	void **buffer, int pages)
+{
+	actor->buffer = buffer;
+	actor->page = NULL;
+	actor->pageaddr = NULL;
+	actor->pages = pages;
+	actor->next_page = 0;
+}
+
+static inline void squashfs_page_actor_init_pages(
+	struct squashfs_page_actor *actor, struct page **page, int pages)
+{
+	squashfs_page_actor_init(actor, NULL, pages);
+	actor->page = page;
+}
+
+/* Done with the buffer being filled, if any */
+static inline void squashfs_finish_page(struct squashfs_page_actor *actor)
+{
+	if (actor->page && actor->pageaddr)
+		kunmap(actor->page[actor->next_page - 1]);
+	actor->pageaddr = NULL;
+}
+
+/* The next buffer to fill, or NULL once they are all used */
+static inline void *squashfs_next_page(struct squashfs_page_actor *actor)
+{
+	squashfs_finish_page(actor);
+	if (actor->next_page == actor->pages)
+		return NULL;
+
+	if (actor->page)
+		actor->pageaddr = kmap(actor->page[actor->next_page]);
+	else
+		actor->pageaddr = actor->buffer[actor->next_page];
+	actor->next_page++;
+	return actor->pageaddr;
+}
+#endif
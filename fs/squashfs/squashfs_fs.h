@@ -208,6 +208,9 @@
 /* cached data constants for filesystem */
 #define SQUASHFS_CACHED_BLKS		8
 
+/* buffer heads submitted at a time when prefetching datablocks */
+#define SQUASHFS_PREFETCH_BH		32
+
 #define SQUASHFS_MAX_FILE_SIZE_LOG	64
 
 #define SQUASHFS_MAX_FILE_SIZE		(1LL << \
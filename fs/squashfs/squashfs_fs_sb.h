@@ -62,10 +62,10 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
-	void					*stream;
+	struct squashfs_stream			*stream;
+	struct squashfs_stream __percpu		*percpu_stream;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
 	u64					directory_table;
@@ -29,6 +29,7 @@
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
+#include "yaffs_summary.h"
 
 #include "yaffs_nameval.h"
 #include "yaffs_allocator.h"
@@ -268,8 +269,8 @@ void yaffs_handle_chunk_error(struct yaffs_dev *dev,
 	}
 }
 
-static void yaffs_handle_chunk_wr_error(struct yaffs_dev *dev, int nand_chunk,
-					int erased_ok)
+void yaffs_handle_chunk_wr_error(struct yaffs_dev *dev, int nand_chunk,
+				 int erased_ok)
 {
 	int flash_block = nand_chunk / dev->param.chunks_per_block;
 	struct yaffs_block_info *bi = yaffs_get_block_info(dev, flash_block);
@@ -440,8 +441,8 @@ static int yaffs_find_alloc_block(struct yaffs_dev *dev)
 	return -1;
 }
 
-static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
-			     struct yaffs_block_info **block_ptr)
+int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
+		      struct yaffs_block_info **block_ptr)
 {
 	int ret_val;
 	struct yaffs_block_info *bi;
@@ -604,6 +605,8 @@ static int yaffs_write_new_chunk(struct yaffs_dev *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_handle_chunk_wr_ok(dev, chunk, data, tags);
 
+		yaffs_summary_add(dev, tags, chunk);
+
 	} while (write_ok != YAFFS_OK &&
 		 (yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1394,10 +1397,26 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache 
  *   provides write buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache can be a few hundred chunks, so chunks are looked up through a
+ *   hash of the object and chunk id, and kept on a list in least recently
+ *   used order. Free chunks sit at the head of that list.
  */
 
+static inline int yaffs_cache_hash(const struct yaffs_obj *obj, int chunk_id)
+{
+	return (obj->obj_id * 31 + chunk_id) & (YAFFS_CACHE_BUCKETS - 1);
+}
+
+/* Take a chunk out of use and put it first in line to be reused */
+static void yaffs_release_cache(struct yaffs_dev *dev,
+				struct yaffs_cache *cache)
+{
+	cache->object = NULL;
+	cache->dirty = 0;
+	list_del_init(&cache->hash_list);
+	list_move(&cache->lru, &dev->cache_lru);
+}
+
 static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
@@ -1448,8 +1467,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 						      cache->chunk_id,
 						      cache->data,
 						      cache->n_bytes, 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_release_cache(dev, cache);
 			}
 
 		} while (cache && chunk_written > 0);
@@ -1493,73 +1511,83 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev)
 
 /* Grab us a cache chunk for use.
  * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then push out the least recently used one that is not locked, flushing
+ * its object first if it is dirty.
  */
 static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
 {
-	int i;
+	struct yaffs_cache *cache;
 
 	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
+		cache = list_first_entry(&dev->cache_lru, struct yaffs_cache,
+					 lru);
+		if (!cache->object)
+			return cache;
 	}
 
 	return NULL;
 }
 
-static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
+static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev,
+						  struct yaffs_obj *obj,
+						  int chunk_id)
 {
 	struct yaffs_cache *cache;
-	struct yaffs_obj *the_obj;
-	int usage;
-	int i;
-	int pushout;
+	struct yaffs_cache *victim;
 
-	if (dev->param.n_caches > 0) {
-		/* Try find a non-dirty one... */
+	if (dev->param.n_caches <= 0)
+		return NULL;
 
-		cache = yaffs_grab_chunk_worker(dev);
+	cache = yaffs_grab_chunk_worker(dev);
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (!cache) {
+		list_for_each_entry(victim, &dev->cache_lru, lru) {
+			if (!victim->locked) {
+				cache = victim;
+				break;
+			}
+		}
 
-			/* With locking we can't assume we can use entry zero */
+		if (cache && cache->dirty) {
+			/* Flush and try again */
+			yaffs_flush_file_cache(cache->object);
+			cache = yaffs_grab_chunk_worker(dev);
+		} else if (cache) {
+			yaffs_release_cache(dev, cache);
+		}
+	}
 
-			the_obj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	if (!cache)
+		return NULL;
 
-			for (i = 0; i < dev->param.n_caches; i++) {
-				if (dev->cache[i].object &&
-				    !dev->cache[i].locked &&
-				    (dev->cache[i].last_use < usage
-				     || !cache)) {
-					usage = dev->cache[i].last_use;
-					the_obj = dev->cache[i].object;
-					cache = &dev->cache[i];
-					pushout = i;
-				}
-			}
+	cache->object = obj;
+	cache->chunk_id = chunk_id;
+	cache->dirty = 0;
+	cache->locked = 0;
+	list_add(&cache->hash_list,
+		 &dev->cache_hash[yaffs_cache_hash(obj, chunk_id)]);
+	list_move_tail(&cache->lru, &dev->cache_lru);
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_flush_file_cache(the_obj);
-				cache = yaffs_grab_chunk_worker(dev);
-			}
+	return cache;
+}
 
-		}
-		return cache;
-	} else {
+static struct yaffs_cache *yaffs_lookup_chunk_cache(const struct yaffs_obj *obj,
+						    int chunk_id)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
+
+	if (dev->param.n_caches <= 0)
 		return NULL;
-        }
+
+	list_for_each_entry(cache,
+			    &dev->cache_hash[yaffs_cache_hash(obj, chunk_id)],
+			    hash_list) {
+		if (cache->object == obj && cache->chunk_id == chunk_id)
+			return cache;
+	}
+
+	return NULL;
 }
 
 /* Find a cached chunk */
@@ -1567,38 +1595,27 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == obj &&
-			    dev->cache[i].chunk_id == chunk_id) {
-				dev->cache_hits++;
+	struct yaffs_cache *cache;
 
-				return &dev->cache[i];
-			}
-		}
-	}
-	return NULL;
+	if (dev->param.n_caches <= 0)
+		return NULL;
+
+	cache = yaffs_lookup_chunk_cache(obj, chunk_id);
+	if (cache)
+		dev->cache_hits++;
+	else
+		dev->cache_misses++;
+
+	return cache;
 }
 
-/* Mark the chunk for the least recently used algorithym */
+/* Mark the chunk as the most recently used */
 static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 			    int is_write)
 {
 
 	if (dev->param.n_caches > 0) {
-		if (dev->cache_last_use < 0 || dev->cache_last_use > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.n_caches; i++)
-				dev->cache[i].last_use = 0;
-
-			dev->cache_last_use = 0;
-		}
-
-		dev->cache_last_use++;
-
-		cache->last_use = dev->cache_last_use;
+		list_move_tail(&cache->lru, &dev->cache_lru);
 
 		if (is_write)
 			cache->dirty = 1;
@@ -1613,10 +1630,10 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 {
 	if (object->my_dev->param.n_caches > 0) {
 		struct yaffs_cache *cache =
-		    yaffs_find_chunk_cache(object, chunk_id);
+		    yaffs_lookup_chunk_cache(object, chunk_id);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_release_cache(object->my_dev, cache);
 	}
 }
 
@@ -1632,7 +1649,7 @@ static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->param.n_caches; i++) {
 			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
+				yaffs_release_cache(dev, &dev->cache[i]);
 		}
 	}
 }
@@ -3580,11 +3597,8 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 
 				if (!cache) {
 					cache =
-					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					    yaffs_grab_chunk_cache(in->my_dev,
+								   in, chunk);
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
 					cache->n_bytes = 0;
@@ -3706,13 +3720,11 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 
 				if (!cache
 				    && yaffs_check_alloc_available(dev, 1)) {
-					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
+					cache = yaffs_grab_chunk_cache(dev, in,
+								       chunk);
+					if (cache)
+						yaffs_rd_data_obj(in, chunk,
+								  cache->data);
 				} else if (cache &&
 					   !cache->dirty &&
 					   !yaffs_check_alloc_available(dev,
@@ -4764,6 +4776,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	int init_failed = 0;
 	unsigned x;
 	int bits;
+	int i;
 
 	yaffs_trace(YAFFS_TRACE_TRACING, "yaffs: yaffs_guts_initialise()" );
 
@@ -4939,17 +4952,20 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	INIT_LIST_HEAD(&dev->cache_lru);
+	for (i = 0; i < YAFFS_CACHE_BUCKETS; i++)
+		INIT_LIST_HEAD(&dev->cache_hash[i]);
 	dev->gc_cleanup_list = NULL;
+	dev->sum_tags = NULL;
 
 	if (!init_failed && dev->param.n_caches > 0) {
-		int i;
 		void *buf;
-		int cache_bytes =
-		    dev->param.n_caches * sizeof(struct yaffs_cache);
+		int cache_bytes;
 
 		if (dev->param.n_caches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.n_caches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		cache_bytes = dev->param.n_caches * sizeof(struct yaffs_cache);
 		dev->cache = kmalloc(cache_bytes, GFP_NOFS);
 
 		buf = (u8 *) dev->cache;
@@ -4959,18 +4975,18 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
 			dev->cache[i].dirty = 0;
+			INIT_LIST_HEAD(&dev->cache[i].hash_list);
+			list_add_tail(&dev->cache[i].lru, &dev->cache_lru);
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->cache_last_use = 0;
 	}
 
 	dev->cache_hits = 0;
+	dev->cache_misses = 0;
 
 	if (!init_failed) {
 		dev->gc_cleanup_list =
@@ -4980,6 +4996,9 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 			init_failed = 1;
 	}
 
+	if (!init_failed && !yaffs_summary_init(dev))
+		init_failed = 1;
+
 	if (dev->param.is_yaffs2)
 		dev->param.use_header_file_size = 1;
 
@@ -5089,6 +5108,7 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 		}
 
 		kfree(dev->gc_cleanup_list);
+		yaffs_summary_deinit(dev);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			kfree(dev->temp_buffer[i].buffer);
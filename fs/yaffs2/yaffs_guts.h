@@ -83,7 +83,11 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+/* Pseudo object id for block summaries */
+#define YAFFS_OBJECTID_SUMMARY		0x30
+
+#define YAFFS_MAX_SHORT_OP_CACHES	256
+#define YAFFS_CACHE_BUCKETS		64
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -110,7 +114,8 @@
 struct yaffs_cache {
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
+	struct list_head hash_list;	/* In dev->cache_hash while in use */
+	struct list_head lru;	/* In dev->cache_lru, oldest first */
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -506,8 +511,8 @@ struct yaffs_param {
 	/* reserved blocks on NOR and RAM. */
 
 	int n_caches;		/* If <= 0, then short op caching is disabled, else
-				 * the number of short op caches (don't use too many).
-				 * 10 to 20 is a good bet.
+				 * the number of short op caches, at most
+				 * YAFFS_MAX_SHORT_OP_CACHES.
 				 */
 	int use_nand_ecc;	/* Flag to decide whether or not to use NANDECC on data (yaffs1) */
 	int no_tags_ecc;	/* Flag to decide whether or not to do ECC on packed tags (yaffs2) */
@@ -574,6 +579,15 @@ struct yaffs_param {
 	int auto_unicode;
 #endif
 	int always_check_erased;	/* Force chunk erased check always on */
+
+	int disable_summary;	/* yaffs2 only: Don't write block summaries */
+};
+
+/* Tags of one chunk as kept in a block summary */
+struct yaffs_summary_tags {
+	unsigned obj_id;
+	unsigned chunk_id;
+	unsigned n_bytes;
 };
 
 struct yaffs_dev {
@@ -685,7 +699,14 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct list_head cache_lru;
+	struct list_head cache_hash[YAFFS_CACHE_BUCKETS];
+
+	/* Block summaries */
+	int chunks_per_summary;	/* 0 if summaries are not in use */
+	struct yaffs_summary_tags *sum_tags;
+	int sum_block;		/* Block being summarised, -1 for none */
+	int sum_next;		/* Next chunk expected in sum_block */
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted files live. */
@@ -734,6 +755,7 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 cache_misses;
 
 };
 
@@ -864,8 +886,12 @@ int yaffs_dump_obj(struct yaffs_obj *obj);
 void yaffs_guts_test(struct yaffs_dev *dev);
 
 /* A few useful functions to be used within the core files*/
+int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
+		      struct yaffs_block_info **block_ptr);
 void yaffs_chunk_del(struct yaffs_dev *dev, int chunk_id, int mark_flash,
 		     int lyn);
+void yaffs_handle_chunk_wr_error(struct yaffs_dev *dev, int nand_chunk,
+				 int erased_ok);
 int yaffs_check_ff(u8 * buffer, int n_bytes);
 void yaffs_handle_chunk_error(struct yaffs_dev *dev,
 			      struct yaffs_block_info *bi);
@@ -0,0 +1,259 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * When the checkpoint is missing or invalid, mounting a yaffs2 device
+ * means scanning it, and the scan reads the tags of every chunk of every
+ * block in use. To speed that up the last chunk of each block is kept
+ * back for a summary: a copy of the packed tags of all the other chunks of
+ * the block. The scan reads the summary chunk and takes the tags from it,
+ * so it only has to read one chunk per block (plus the object headers that
+ * it needs to read anyway).
+ *
+ * A summary is only written for a block that was filled from its first
+ * chunk during this mount without failures, so that every entry is known
+ * to be right. A block without a valid summary is simply scanned chunk by
+ * chunk as before. The summary chunk is garbage as soon as it is written:
+ * it is deleted straight away and never copied by the garbage collector.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_packedtags2.h"
+#include "yaffs_nand.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_bitmap.h"
+#include "yaffs_tagsvalidity.h"
+#include "yaffs_trace.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+struct yaffs_summary_header {
+	unsigned version;	/* YAFFS_SUMMARY_VERSION */
+	unsigned block;		/* block number, for sanity checking */
+	unsigned seq;		/* block sequence number */
+	unsigned sum;		/* checksum of the tags that follow */
+};
+
+static unsigned yaffs_summary_sum(struct yaffs_dev *dev)
+{
+	u8 *p = (u8 *) dev->sum_tags;
+	unsigned sum = 0;
+	int i;
+
+	for (i = 0; i < dev->chunks_per_summary *
+	     sizeof(struct yaffs_summary_tags); i++)
+		sum += p[i];
+
+	return sum;
+}
+
+int yaffs_summary_init(struct yaffs_dev *dev)
+{
+	int sum_bytes;
+
+	dev->chunks_per_summary = 0;
+	dev->sum_block = -1;
+
+	if (!dev->param.is_yaffs2 || dev->param.disable_summary)
+		return YAFFS_OK;
+
+	/* The summary has to fit in the one chunk kept back for it */
+	dev->chunks_per_summary = dev->param.chunks_per_block - 1;
+	sum_bytes = dev->chunks_per_summary * sizeof(struct yaffs_summary_tags);
+	if (sizeof(struct yaffs_summary_header) + sum_bytes >
+	    dev->data_bytes_per_chunk) {
+		yaffs_trace(YAFFS_TRACE_ALWAYS,
+			"yaffs: block summaries do not fit in a chunk");
+		dev->chunks_per_summary = 0;
+		return YAFFS_OK;
+	}
+
+	dev->sum_tags = kmalloc(sum_bytes, GFP_NOFS);
+	if (!dev->sum_tags) {
+		dev->chunks_per_summary = 0;
+		return YAFFS_FAIL;
+	}
+
+	return YAFFS_OK;
+}
+
+void yaffs_summary_deinit(struct yaffs_dev *dev)
+{
+	kfree(dev->sum_tags);
+	dev->sum_tags = NULL;
+	dev->chunks_per_summary = 0;
+}
+
+static void yaffs_summary_write(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	struct yaffs_block_info *bi;
+	int chunk;
+	u8 *buffer;
+
+	/* The last chunk of the block, still ours since it is allocating */
+	chunk = yaffs_alloc_chunk(dev, 1, &bi);
+	if (chunk < 0)
+		return;
+	if (chunk / dev->param.chunks_per_block != blk) {
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: summary chunk %d is not in block %d",
+			chunk, blk);
+		yaffs_chunk_del(dev, chunk, 0, __LINE__);
+		return;
+	}
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+	memset(buffer, 0xff, dev->data_bytes_per_chunk);
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.seq = bi->seq_number;
+	hdr.sum = yaffs_summary_sum(dev);
+	memcpy(buffer, &hdr, sizeof(hdr));
+	memcpy(buffer + sizeof(hdr), dev->sum_tags,
+	       dev->chunks_per_summary * sizeof(struct yaffs_summary_tags));
+
+	yaffs_init_tags(&tags);
+	tags.obj_id = YAFFS_OBJECTID_SUMMARY;
+	tags.chunk_id = 1;
+	tags.n_bytes = sizeof(hdr) +
+	    dev->chunks_per_summary * sizeof(struct yaffs_summary_tags);
+
+	if (yaffs_wr_chunk_tags_nand(dev, chunk, buffer, &tags) != YAFFS_OK) {
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: failed to write summary of block %d", blk);
+		yaffs_release_temp_buffer(dev, buffer, __LINE__);
+		/* Retires the block and deletes the chunk */
+		yaffs_handle_chunk_wr_error(dev, chunk, 1);
+		return;
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+
+	/* Nothing refers to the summary, it is garbage from the start */
+	yaffs_chunk_del(dev, chunk, 0, __LINE__);
+}
+
+/*
+ * Record the tags of a chunk just written. When the last data chunk of a
+ * block has been written with all the chunks before it recorded, the
+ * summary goes into the remaining chunk.
+ */
+void yaffs_summary_add(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+		       int chunk_in_nand)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+	struct yaffs_summary_tags *sum_tags;
+	int blk = chunk_in_nand / dev->param.chunks_per_block;
+	int chunk_in_block = chunk_in_nand % dev->param.chunks_per_block;
+
+	if (!dev->chunks_per_summary ||
+	    chunk_in_block >= dev->chunks_per_summary)
+		return;
+
+	if (chunk_in_block == 0) {
+		dev->sum_block = blk;
+		dev->sum_next = 0;
+	}
+
+	if (blk != dev->sum_block || chunk_in_block != dev->sum_next) {
+		/* A chunk was skipped or we came in halfway, no summary */
+		dev->sum_block = -1;
+		return;
+	}
+
+	yaffs_pack_tags2_tags_only(&tags_only, tags);
+	sum_tags = &dev->sum_tags[chunk_in_block];
+	sum_tags->obj_id = tags_only.obj_id;
+	sum_tags->chunk_id = tags_only.chunk_id;
+	sum_tags->n_bytes = tags_only.n_bytes;
+	dev->sum_next++;
+
+	if (dev->sum_next == dev->chunks_per_summary) {
+		dev->sum_block = -1;
+		yaffs_summary_write(dev, blk);
+	}
+}
+
+/*
+ * Read the summary of a block being scanned into dev->sum_tags. Returns
+ * YAFFS_OK if the block has a valid summary.
+ */
+int yaffs_summary_read(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	int chunk = (blk + 1) * dev->param.chunks_per_block - 1;
+	int result = YAFFS_FAIL;
+	u8 *buffer;
+
+	if (!dev->chunks_per_summary)
+		return YAFFS_FAIL;
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+	yaffs_rd_chunk_tags_nand(dev, chunk, buffer, &tags);
+
+	if (!tags.chunk_used || tags.obj_id != YAFFS_OBJECTID_SUMMARY ||
+	    tags.seq_number != bi->seq_number ||
+	    tags.ecc_result > YAFFS_ECC_RESULT_FIXED)
+		goto out;
+
+	memcpy(&hdr, buffer, sizeof(hdr));
+	memcpy(dev->sum_tags, buffer + sizeof(hdr),
+	       dev->chunks_per_summary * sizeof(struct yaffs_summary_tags));
+
+	if (hdr.version != YAFFS_SUMMARY_VERSION || hdr.block != blk ||
+	    hdr.seq != bi->seq_number || hdr.sum != yaffs_summary_sum(dev)) {
+		yaffs_trace(YAFFS_TRACE_SCAN,
+			"Block %d has a bad summary, scanning it", blk);
+		goto out;
+	}
+
+	result = YAFFS_OK;
+out:
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+	return result;
+}
+
+/*
+ * Fill in the tags of a chunk from the summary read by yaffs_summary_read.
+ * The last chunk gets the tags of the summary itself. The caller sets the
+ * sequence number.
+ */
+void yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+			 int chunk_in_block)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+	struct yaffs_summary_tags *sum_tags;
+
+	if (chunk_in_block >= dev->chunks_per_summary) {
+		yaffs_init_tags(tags);
+		tags->chunk_used = 1;
+		tags->obj_id = YAFFS_OBJECTID_SUMMARY;
+		tags->chunk_id = 1;
+		return;
+	}
+
+	sum_tags = &dev->sum_tags[chunk_in_block];
+	tags_only.obj_id = sum_tags->obj_id;
+	tags_only.chunk_id = sum_tags->chunk_id;
+	tags_only.n_bytes = sum_tags->n_bytes;
+	tags_only.seq_number = 0;
+	yaffs_unpack_tags2_tags_only(tags, &tags_only);
+	tags->ecc_result = YAFFS_ECC_RESULT_NO_ERROR;
+}
@@ -1769,6 +1769,8 @@ struct yaffs_options {
 	int lazy_loading_overridden;
 	int empty_lost_and_found;
 	int empty_lost_and_found_overridden;
+	int summary;
+	int summary_overridden;
 };
 
 #define MAX_OPT_LEN 30
@@ -1818,6 +1820,12 @@ static int yaffs_parse_options(struct yaffs_options *options,
 			options->empty_lost_and_found_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
+		} else if (!strcmp(cur_opt, "summary")) {
+			options->summary = 1;
+			options->summary_overridden = 1;
+		} else if (!strcmp(cur_opt, "no-summary")) {
+			options->summary = 0;
+			options->summary_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
 			options->skip_checkpoint_read = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-write")) {
@@ -2011,6 +2019,19 @@ static const struct super_operations yaffs_super_ops = {
 	.write_super = yaffs_write_super,
 };
 
+/*
+ * Size the short op cache from the amount of memory: up to 1/512 of RAM,
+ * but never less than the 10 chunks yaffs has always used.
+ */
+static int yaffs_auto_n_caches(int bytes_per_chunk)
+{
+	u64 n = (u64)totalram_pages << PAGE_SHIFT;
+
+	do_div(n, 512 * bytes_per_chunk);
+
+	return clamp_t(u64, n, 10, YAFFS_MAX_SHORT_OP_CACHES);
+}
+
 static struct super_block *yaffs_internal_read_super(int yaffs_version,
 						     struct super_block *sb,
 						     void *data, int silent)
@@ -2220,7 +2241,6 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->chunks_per_block = YAFFS_CHUNKS_PER_BLOCK;
 	param->total_bytes_per_chunk = YAFFS_BYTES_PER_CHUNK;
 	param->n_reserved_blocks = 5;
-	param->n_caches = (options.no_cache) ? 0 : 10;
 	param->inband_tags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2258,6 +2278,12 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->always_check_erased = 1;
 #endif
 
+#ifndef CONFIG_YAFFS_SUMMARY
+	param->disable_summary = 1;
+#endif
+	if (options.summary_overridden)
+		param->disable_summary = !options.summary;
+
 	if (options.empty_lost_and_found_overridden)
 		param->empty_lost_n_found = options.empty_lost_and_found;
 
@@ -2299,6 +2325,9 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->use_nand_ecc = 1;
 #endif
 
+	param->n_caches = (options.no_cache) ? 0 :
+	    yaffs_auto_n_caches(param->total_bytes_per_chunk);
+
 	param->skip_checkpt_rd = options.skip_checkpoint_read;
 	param->skip_checkpt_wr = options.skip_checkpoint_write;
 
@@ -2489,6 +2518,7 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "cache_misses.......... %u\n", dev->cache_misses);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
@@ -20,6 +20,7 @@
 #include "yaffs_getblockinfo.h"
 #include "yaffs_verify.h"
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /*
  * Checkpoints are really no benefit on very small partitions.
@@ -981,6 +982,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	int file_size;
 	int is_shrink;
 	int found_chunks;
+	int summary_available;
 	int equiv_id;
 	int alloc_failed = 0;
 
@@ -1102,6 +1104,13 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		deleted = 0;
 
+		/* A valid summary saves reading the tags of every chunk */
+		summary_available = 0;
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+		    dev->chunks_per_summary &&
+		    yaffs_summary_read(dev, blk) == YAFFS_OK)
+			summary_available = 1;
+
 		/* For each chunk in each block that needs scanning.... */
 		found_chunks = 0;
 		for (c = dev->param.chunks_per_block - 1;
@@ -1114,8 +1123,13 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (summary_available) {
+				yaffs_summary_fetch(dev, &tags, c);
+				tags.seq_number = bi->seq_number;
+			} else {
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
+			}
 
 			/* Let's have a good look at this chunk... */
 
@@ -1176,6 +1190,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 				dev->n_free_chunks++;
 
+			} else if (tags.obj_id == YAFFS_OBJECTID_SUMMARY) {
+				/* A block summary, always garbage */
+				found_chunks = 1;
+				dev->n_free_chunks++;
+
 			} else if (tags.obj_id > YAFFS_MAX_OBJECT_ID ||
 				   tags.chunk_id > YAFFS_MAX_CHUNK_ID ||
 				   (tags.chunk_id > 0
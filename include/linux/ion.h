@@ -143,6 +143,7 @@ struct ion_buffer;
  * @base:	base address of heap in physical memory if applicable
  * @size:	size of the heap in bytes if applicable
  * @memory_type:Memory type used for the heap
+ * @flags:	ION_HEAP_FLAG_* flags for the heap
  * @extra_data:	Extra data specific to each heap type
  */
 struct ion_platform_heap {
@@ -152,9 +153,17 @@ struct ion_platform_heap {
 	ion_phys_addr_t base;
 	size_t size;
 	enum ion_memory_types memory_type;
+	unsigned long flags;
 	void *extra_data;
 };
 
+/*
+ * Free buffers of the heap from a kernel thread instead of on the last
+ * put, and keep recently freed buffers around for allocations of the
+ * same size.
+ */
+#define ION_HEAP_FLAG_DEFER_FREE	(1 << 0)
+
 /**
  * struct ion_cp_heap_pdata - defines a content protection heap in the given
  * platform
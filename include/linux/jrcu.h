@@ -42,9 +42,11 @@ extern void synchronize_sched(void);
 
 #define synchronize_rcu                                synchronize_sched
 #define synchronize_rcu_bh                     synchronize_sched
-#define synchronize_rcu_expedited              synchronize_sched
-#define synchronize_rcu_bh_expedited           synchronize_sched
-#define synchronize_sched_expedited            synchronize_sched
+
+extern void synchronize_sched_expedited(void);
+
+#define synchronize_rcu_expedited              synchronize_sched_expedited
+#define synchronize_rcu_bh_expedited           synchronize_sched_expedited
 
 #define rcu_init(cpu)                          do { } while (0)
 #define rcu_init_sched()                       do { } while (0)
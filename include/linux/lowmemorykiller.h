@@ -0,0 +1,45 @@
+/*
+ * include/linux/lowmemorykiller.h
+ *
+ * Hooks that keep the task index of the Android low memory killer up to
+ * date. Only thread group leaders of user space processes are indexed,
+ * bucketed by the oom_score_adj of their process.
+ *
+ * Reclaim also reports how many pages it scanned and reclaimed, which the
+ * low memory killer turns into a pressure level when it runs in pressure
+ * mode.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#ifndef _LINUX_LOWMEMORYKILLER_H
+#define _LINUX_LOWMEMORYKILLER_H
+
+#include <linux/types.h>
+
+struct task_struct;
+
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/* called with tasklist_lock held for writing */
+extern void lowmem_task_add(struct task_struct *p);
+extern void lowmem_task_del(struct task_struct *p);
+extern void lowmem_task_replace(struct task_struct *old,
+				struct task_struct *new);
+/* called after p->signal->oom_score_adj changed */
+extern void lowmem_task_adj_changed(struct task_struct *p);
+/* called from shrink_zone for global reclaim */
+extern void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+			      unsigned long reclaimed);
+#else
+static inline void lowmem_task_add(struct task_struct *p) {}
+static inline void lowmem_task_del(struct task_struct *p) {}
+static inline void lowmem_task_replace(struct task_struct *old,
+				       struct task_struct *new) {}
+static inline void lowmem_task_adj_changed(struct task_struct *p) {}
+static inline void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+				     unsigned long reclaimed) {}
+#endif
+
+#endif /* _LINUX_LOWMEMORYKILLER_H */
@@ -0,0 +1,52 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  LZ4 is a very fast LZ77 type compressor whose block format was
+ *  designed by Yann Collet. Decompression is considerably faster than
+ *  LZO at a slightly lower compression ratio.
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(unsigned char *))
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * lz4_compress()
+ *	src	: source address of the original data
+ *	src_len	: size of the original data
+ *	dst	: output buffer address of the compressed data.
+ *		  This requires 'dst' of size lz4_compressbound(src_len).
+ *	dst_len	: is the output size, which is returned after compress done
+ *	workmem : address of the working memory.
+ *		  This requires 'workmem' of size LZ4_MEM_COMPRESS.
+ *	return	: Success if return 0
+ *		  Error if return (< 0)
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src	: source address of the compressed data
+ *	src_len	: is the input size, therefore the compressed size
+ *	dest	: output buffer address of the decompressed data
+ *	dest_len: is the max size of the destination buffer, which is
+ *		  returned with actual size of decompressed data after
+ *		  decompress done
+ *	return	: Success if return 0
+ *		  Error if return (< 0)
+ *	note	: Destination buffer must be already allocated.
+ *		  Malformed input is detected and never causes reads or
+ *		  writes outside of the given buffers.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+
+#endif
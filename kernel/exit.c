@@ -51,6 +51,7 @@
 #include <trace/events/sched.h>
 #include <linux/hw_breakpoint.h>
 #include <linux/oom.h>
+#include <linux/lowmemorykiller.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -68,6 +69,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		detach_pid(p, PIDTYPE_SID);
 
 		list_del_rcu(&p->tasks);
+		lowmem_task_del(p);
 		list_del_init(&p->sibling);
 		__this_cpu_dec(process_counts);
 	}
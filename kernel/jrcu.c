@@ -54,13 +54,16 @@
 
 /*
  * This RCU maintains three callback lists: the current batch (per cpu),
- * the previous batch (also per cpu), and the pending list (global).
+ * the previous batch (also per cpu), and the pending list (global).  With
+ * CONFIG_JRCU_OFFLOAD there is a fourth, the done list (per cpu), which
+ * takes the place of the pending list while callback offload is enabled.
  */
 
 #include <linux/bug.h>
 #include <linux/smp.h>
 #include <linux/ctype.h>
 #include <linux/sched.h>
+#include <linux/ktime.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -68,6 +71,7 @@
 #include <linux/stddef.h>
 #include <linux/string.h>
 #include <linux/preempt.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/compiler.h>
 #include <linux/irqflags.h>
@@ -131,15 +135,31 @@ static inline void rcu_list_join(struct rcu_list *to, struct rcu_list *from)
  */
 static u8 rcu_which ____cacheline_aligned_in_smp;
 
+/*
+ * Counts ends of batches.  It goes up as soon as a batch is known to have
+ * ended, before the cpus are asked to consent to the end of the next one.
+ */
+static unsigned long rcu_eob_seq;
+
 struct rcu_data {
        u8 wait;                /* goes false when this cpu consents to
                                 * the retirement of the current batch */
        struct rcu_list cblist[2]; /* current & previous callback lists */
        s64 nqueued;            /* #callbacks queued (stats-n-debug) */
+#ifdef CONFIG_JRCU_OFFLOAD
+       raw_spinlock_t done_lock;
+       struct rcu_list done;   /* ended callbacks, for this cpu's cbthread */
+       ktime_t done_time;      /* when ->done last went non-empty */
+       struct task_struct *cbthread;
+       s64 ninvoked;           /* #callbacks invoked by cbthread */
+#endif
 } ____cacheline_aligned_in_smp;
 
 static struct rcu_data rcu_data[NR_CPUS];
 
+/* ended callbacks that are invoked inline, by the end-of-batch driver */
+static struct rcu_list rcu_pending;
+
 /* debug & statistics stuff */
 static struct rcu_stats {
        unsigned npasses;       /* #passes made */
@@ -148,16 +168,39 @@ static struct rcu_stats {
        unsigned nmis;          /* #passes discarded due to NMI */
        atomic_t nbarriers;     /* #rcu barriers processed */
        atomic_t nsyncs;        /* #rcu syncs processed */
+       atomic_t nexpedited;    /* #expedited rcu syncs processed */
+       unsigned nexpedited_passes; /* #passes that forced quiescent states */
        s64 ninvoked;           /* #invoked (ie, finished) callbacks */
        unsigned nforced;       /* #forced eobs (should be zero) */
+       unsigned nlimited;      /* #invocation passes cut short by the
+                                * batch limit */
+       unsigned backlog_max;   /* largest backlog seen at an eob */
+       unsigned run_max_us;    /* longest invocation pass */
+       u64 run_us;             /* total time spent invoking callbacks */
+       unsigned offload_max_us; /* longest wait of ended callbacks for
+                                * their cbthread */
 } rcu_stats;
 
 #define RCU_HZ                 (20)
 #define RCU_HZ_PERIOD_US       (USEC_PER_SEC / RCU_HZ)
 #define RCU_HZ_DELTA_US                (USEC_PER_SEC / HZ)
 
+/*
+ * The period shrinks, to no less than RCU_HZ_MIN_PERIOD_US, once the
+ * backlog of not yet invoked callbacks exceeds rcu_backlog_hi; it is
+ * halved at rcu_backlog_hi, cut to a third at twice that, and so on.
+ */
+#define RCU_HZ_MIN_PERIOD_US   (USEC_PER_SEC / 1000)
+#define RCU_BACKLOG_HI         (1000)
+
+/* callbacks invoked per pass; 0 invokes all of them in one go */
+#define RCU_BATCH_LIMIT                (100)
+
 static int rcu_hz_period_us = RCU_HZ_PERIOD_US;
 static int rcu_hz_delta_us = RCU_HZ_DELTA_US;
+static int rcu_period_us = RCU_HZ_PERIOD_US;   /* period in effect */
+static int rcu_backlog_hi = RCU_BACKLOG_HI;
+static int rcu_batch_limit = RCU_BATCH_LIMIT;
 
 static int rcu_hz_precise;
 
@@ -167,6 +210,10 @@ int rcu_nmi_seen __read_mostly;
 static int rcu_wdog_ctr;       /* time since last end-of-batch, in usecs */
 static int rcu_wdog_lim = 10 * USEC_PER_SEC;   /* rcu watchdog interval */
 
+#ifdef CONFIG_JRCU_OFFLOAD
+static int rcu_offload = 1;    /* hand ended callbacks to the cbthreads */
+#endif
+
 /*
  * Return our CPU id or zero if we are too early in the boot process to
  * know what that is.  For RCU to work correctly, a cpu named '0' must
@@ -247,10 +294,13 @@ void synchronize_sched(void)
 }
 EXPORT_SYMBOL_GPL(synchronize_sched);
 
+static void rcu_offload_barrier(void);
+
 void rcu_barrier(void)
 {
        synchronize_sched();
        synchronize_sched();
+       rcu_offload_barrier();
        atomic_inc(&rcu_stats.nbarriers);
 }
 EXPORT_SYMBOL_GPL(rcu_barrier);
@@ -292,13 +342,15 @@ void call_rcu_sched(struct rcu_head *cb, void (*func)(struct rcu_head *rcu))
 EXPORT_SYMBOL_GPL(call_rcu_sched);
 
 /*
- * Invoke all callbacks on the passed-in list.
+ * Invoke up to 'limit' callbacks from the head of the passed-in list,
+ * leaving the rest of the list in place.  Returns #callbacks invoked.
  */
-static void rcu_invoke_callbacks(struct rcu_list *pending)
+static int rcu_invoke_callbacks(struct rcu_list *pending, int limit)
 {
        struct rcu_head *curr, *next;
+       int n;
 
-       for (curr = pending->head; curr;) {
+       for (curr = pending->head, n = 0; curr && n < limit; n++) {
                unsigned long offset = (unsigned long)curr->func;
                next = curr->next;
                if (__is_kfree_rcu_offset(offset))
@@ -306,8 +358,94 @@ static void rcu_invoke_callbacks(struct rcu_list *pending)
                else
                        curr->func(curr);
                curr = next;
-               rcu_stats.ninvoked++;
        }
+
+       pending->head = curr;
+       pending->count -= n;
+       if (curr == NULL)
+               rcu_list_init(pending);
+       return n;
+}
+
+/*
+ * One invocation pass over a list of ended callbacks, at most
+ * rcu_batch_limit of them.  The caller loops, or comes back on its next
+ * pass, for whatever is left on the list.
+ */
+static void rcu_invoke_pass(struct rcu_list *pending, s64 *ninvoked)
+{
+       int limit = rcu_batch_limit;
+       ktime_t start;
+       unsigned us;
+
+       if (limit <= 0)
+               limit = INT_MAX;
+
+       start = ktime_get();
+       *ninvoked += rcu_invoke_callbacks(pending, limit);
+       us = ktime_us_delta(ktime_get(), start);
+
+       rcu_stats.run_us += us;
+       if (us > rcu_stats.run_max_us)
+               rcu_stats.run_max_us = us;
+       if (pending->head)
+               rcu_stats.nlimited++;
+}
+
+#ifdef CONFIG_JRCU_OFFLOAD
+/*
+ * Hand a cpu's previous batch of callbacks to its cbthread.  Callbacks
+ * stay on the cpu that queued them, which is where their data is most
+ * likely still cache hot.
+ */
+static inline bool rcu_offload_batch(struct rcu_data *rd,
+       struct rcu_list *plist)
+{
+       if (!rcu_offload || !rd->cbthread)
+               return false;
+
+       raw_spin_lock(&rd->done_lock);
+       if (!rd->done.head)
+               rd->done_time = ktime_get();
+       rcu_list_join(&rd->done, plist);
+       raw_spin_unlock(&rd->done_lock);
+       return true;
+}
+
+static inline int rcu_offload_backlog(struct rcu_data *rd)
+{
+       return ACCESS_ONCE(rd->done.count);
+}
+#else
+static inline bool rcu_offload_batch(struct rcu_data *rd,
+       struct rcu_list *plist)
+{
+       return false;
+}
+
+static inline int rcu_offload_backlog(struct rcu_data *rd)
+{
+       return 0;
+}
+#endif /* CONFIG_JRCU_OFFLOAD */
+
+/*
+ * Pick the period for the next pass from the number of callbacks queued
+ * but not yet invoked.
+ */
+static void rcu_adapt_period(int backlog)
+{
+       int period = rcu_hz_period_us;
+
+       if ((unsigned)backlog > rcu_stats.backlog_max)
+               rcu_stats.backlog_max = backlog;
+
+       if (rcu_backlog_hi > 0 && backlog >= rcu_backlog_hi) {
+               period /= backlog / rcu_backlog_hi + 1;
+               if (period < RCU_HZ_MIN_PERIOD_US)
+                       period = RCU_HZ_MIN_PERIOD_US;
+       }
+       rcu_period_us = period;
 }
 
 /*
@@ -322,14 +460,14 @@ static void rcu_invoke_callbacks(struct rcu_list *pending)
  * "Quiescent" means the owning cpu is no longer appending callbacks
  * and has completed execution of a trailing write-memory-barrier insn.
  */
-static void __rcu_delimit_batches(struct rcu_list *pending)
+static int __rcu_delimit_batches(struct rcu_list *pending)
 {
        struct rcu_data *rd;
        struct rcu_list *plist;
-       int cpu, eob, prev;
+       int cpu, eob, prev, backlog;
 
        if (!rcu_scheduler_active)
-               return;
+               return 0;
 
        rcu_stats.nlast++;
 
@@ -339,7 +477,7 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
        if (rcu_nmi_seen) {
                rcu_nmi_seen = 0;
                rcu_stats.nmis++;
-               return;
+               return 0;
        }
 
        /*
@@ -371,30 +509,38 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
                                        force_cpu_resched(cpu);
                        }
                }
-               rcu_wdog_ctr += rcu_hz_period_us;
-               return;
+               rcu_wdog_ctr += rcu_period_us;
+               return 0;
        }
 
        /*
         * End the current RCU batch and start a new one.
         *
         * This is a two-step operation: move every cpu's previous list
-        * to the global pending list, then tell every cpu to swap its
-        * current and pending lists (ie, toggle rcu_which).
+        * to the global pending list (or to the cpu's done list, when
+        * offloading), then tell every cpu to swap its current and
+        * pending lists (ie, toggle rcu_which).
         *
         * We tolerate the cpus taking a bit of time noticing this swap;
         * we expect them to continue to put callbacks on the old current
         * list (which is now the previous list) for a while.  That time,
         * however, cannot exceed one RCU_HZ period.
         */
+       rcu_eob_seq++;
+       smp_mb(); /* order the count before asking the cpus for consent */
+
        prev = ACCESS_ONCE(rcu_which) ^ 1;
+       backlog = pending->count;
 
        for_each_present_cpu(cpu) {
                rd = &rcu_data[cpu];
                plist = &rd->cblist[prev];
+               backlog += plist->count + rd->cblist[prev ^ 1].count;
+               backlog += rcu_offload_backlog(rd);
                /* Chain previous batch of callbacks, if any, to the pending list */
                if (plist->head) {
-                       rcu_list_join(pending, plist);
+                       if (!rcu_offload_batch(rd, plist))
+                               rcu_list_join(pending, plist);
                        rcu_list_init(plist);
                }
                if (cpu_online(cpu)) /* wins race with offlining every time */
@@ -416,26 +562,221 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
        rcu_stats.nbatches++;
        rcu_stats.nlast = 0;
        rcu_wdog_ctr = 0;
+       rcu_adapt_period(backlog);
+       return 1;
+}
+
+#ifdef CONFIG_JRCU_OFFLOAD
+static void rcu_wake_cbthreads(void)
+{
+       int cpu;
+
+       for_each_present_cpu(cpu) {
+               struct rcu_data *rd = &rcu_data[cpu];
+               if (rd->cbthread && ACCESS_ONCE(rd->done.head))
+                       wake_up_process(rd->cbthread);
+       }
 }
+#else
+static inline void rcu_wake_cbthreads(void)
+{
+}
+#endif
 
+#ifdef CONFIG_JRCU_DAEMON
+static void rcu_wake_expedited(void);
+#else
+static inline void rcu_wake_expedited(void)
+{
+}
+#endif
+
+/*
+ * Callbacks left on rcu_pending by the batch limit are invoked on the
+ * next pass, ahead of those of any batch ended in the meantime.
+ */
 static void rcu_delimit_batches(void)
 {
        unsigned long flags;
-       struct rcu_list pending;
+       int eob;
 
-       rcu_list_init(&pending);
        rcu_stats.npasses++;
 
        raw_local_irq_save(flags);
        smp_mb();
-       __rcu_delimit_batches(&pending);
+       eob = __rcu_delimit_batches(&rcu_pending);
        smp_mb();
        raw_local_irq_restore(flags);
 
-       if (pending.head)
-               rcu_invoke_callbacks(&pending);
+       if (eob) {
+               rcu_wake_expedited();
+               rcu_wake_cbthreads();
+       }
+
+       if (rcu_pending.head)
+               rcu_invoke_pass(&rcu_pending, &rcu_stats.ninvoked);
 }
 
+/* ------------------ callback offload section ------------------ */
+
+#ifdef CONFIG_JRCU_OFFLOAD
+
+/*
+ * Each cpu has a kernel thread, jrcuc/N, that invokes the callbacks
+ * handed to its done list at end-of-batch, rcu_batch_limit of them at a
+ * time with a chance to reschedule in between.  The threads are merely
+ * preferably bound; they follow their callbacks elsewhere when their
+ * cpu goes offline.
+ */
+
+#include <linux/cpu.h>
+#include <linux/err.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+
+static int rcu_cbthread_func(void *arg)
+{
+       struct rcu_data *rd = arg;
+       struct rcu_list done;
+       unsigned us;
+
+       current->flags |= PF_NOFREEZE;
+
+       for (;;) {
+               set_current_state(TASK_INTERRUPTIBLE);
+               if (!ACCESS_ONCE(rd->done.head)) {
+                       schedule();
+                       continue;
+               }
+               __set_current_state(TASK_RUNNING);
+
+               raw_spin_lock_irq(&rd->done_lock);
+               done = rd->done;
+               rcu_list_init(&rd->done);
+               us = ktime_us_delta(ktime_get(), rd->done_time);
+               raw_spin_unlock_irq(&rd->done_lock);
+
+               if (us > rcu_stats.offload_max_us)
+                       rcu_stats.offload_max_us = us;
+
+               while (done.head) {
+                       rcu_invoke_pass(&done, &rd->ninvoked);
+                       cond_resched();
+               }
+       }
+       return 0;
+}
+
+static DEFINE_MUTEX(rcu_barrier_mutex);
+static struct rcu_head rcu_barrier_head[NR_CPUS];
+static atomic_t rcu_barrier_count;
+static struct completion rcu_barrier_completion;
+
+static void rcu_barrier_func(struct rcu_head *unused)
+{
+       if (atomic_dec_and_test(&rcu_barrier_count))
+               complete(&rcu_barrier_completion);
+}
+
+/*
+ * The two syncs of rcu_barrier() only guarantee that every earlier
+ * callback has been moved to some done list.  The cbthreads run their
+ * lists in order, so a marker at the tail of each list is invoked after
+ * all of those callbacks.
+ */
+static void rcu_offload_barrier(void)
+{
+       int cpu;
+
+       mutex_lock(&rcu_barrier_mutex);
+       init_completion(&rcu_barrier_completion);
+       atomic_set(&rcu_barrier_count, 1);
+
+       for_each_present_cpu(cpu) {
+               struct rcu_data *rd = &rcu_data[cpu];
+               struct rcu_head *h = &rcu_barrier_head[cpu];
+
+               if (!rd->cbthread)
+                       continue;
+               h->func = rcu_barrier_func;
+               atomic_inc(&rcu_barrier_count);
+
+               raw_spin_lock_irq(&rd->done_lock);
+               if (!rd->done.head)
+                       rd->done_time = ktime_get();
+               rcu_list_add(&rd->done, h);
+               raw_spin_unlock_irq(&rd->done_lock);
+               wake_up_process(rd->cbthread);
+       }
+
+       rcu_barrier_func(NULL);
+       wait_for_completion(&rcu_barrier_completion);
+       mutex_unlock(&rcu_barrier_mutex);
+}
+
+static int __cpuinit rcu_cbthread_cpu_notify(struct notifier_block *nb,
+       unsigned long action, void *hcpu)
+{
+       long cpu = (long)hcpu;
+       struct task_struct *p = rcu_data[cpu].cbthread;
+
+       if (p && (action & ~CPU_TASKS_FROZEN) == CPU_ONLINE)
+               set_cpus_allowed_ptr(p, cpumask_of(cpu));
+       return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata rcu_cbthread_cpu_nb = {
+       .notifier_call = rcu_cbthread_cpu_notify,
+};
+
+static __init void rcu_start_cbthreads(void)
+{
+       struct task_struct *p;
+       int cpu;
+
+       get_online_cpus();
+       for_each_possible_cpu(cpu) {
+               p = kthread_create(rcu_cbthread_func, &rcu_data[cpu],
+                       "jrcuc/%d", cpu);
+               if (IS_ERR(p)) {
+                       pr_warn("JRCU: no jrcuc/%d, its callbacks stay inline\n",
+                               cpu);
+                       continue;
+               }
+               if (cpu_online(cpu))
+                       set_cpus_allowed_ptr(p, cpumask_of(cpu));
+               rcu_data[cpu].cbthread = p;
+               wake_up_process(p);
+       }
+       register_hotcpu_notifier(&rcu_cbthread_cpu_nb);
+       put_online_cpus();
+}
+
+static __init void rcu_offload_init(void)
+{
+       int cpu;
+
+       for_each_possible_cpu(cpu)
+               raw_spin_lock_init(&rcu_data[cpu].done_lock);
+}
+
+#else /* CONFIG_JRCU_OFFLOAD */
+
+static inline void rcu_offload_barrier(void)
+{
+}
+
+static inline void rcu_start_cbthreads(void)
+{
+}
+
+static inline void rcu_offload_init(void)
+{
+}
+
+#endif /* CONFIG_JRCU_OFFLOAD */
+
 /* ------------------ interrupt driver section ------------------ */
 
 /*
@@ -448,7 +789,7 @@ static void rcu_delimit_batches(void)
 #include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 
-#define rcu_hz_period_ns       (rcu_hz_period_us * NSEC_PER_USEC)
+#define rcu_period_ns          (rcu_period_us * NSEC_PER_USEC)
 #define rcu_hz_delta_ns                (rcu_hz_delta_us * NSEC_PER_USEC)
 
 static struct hrtimer rcu_timer;
@@ -464,7 +805,7 @@ static enum hrtimer_restart rcu_timer_func(struct hrtimer *t)
 
        raise_softirq(RCU_SOFTIRQ);
 
-       next = ktime_add_ns(ktime_get(), rcu_hz_period_ns);
+       next = ktime_add_ns(ktime_get(), rcu_period_ns);
        hrtimer_set_expires_range_ns(&rcu_timer, next,
                rcu_hz_precise ? 0 : rcu_hz_delta_ns);
        return HRTIMER_RESTART;
@@ -472,7 +813,7 @@ static enum hrtimer_restart rcu_timer_func(struct hrtimer *t)
 
 static void rcu_timer_start(void)
 {
-       hrtimer_forward_now(&rcu_timer, ns_to_ktime(rcu_hz_period_ns));
+       hrtimer_forward_now(&rcu_timer, ns_to_ktime(rcu_period_ns));
        hrtimer_start_expires(&rcu_timer, HRTIMER_MODE_ABS);
 }
 
@@ -493,13 +834,21 @@ static void rcu_timer_stop(void)
 
 void __init rcu_scheduler_starting(void)
 {
+       rcu_offload_init();
        rcu_timer_init();
 }
 
 #ifndef CONFIG_JRCU_DAEMON
 
+void synchronize_sched_expedited(void)
+{
+       synchronize_sched();
+}
+EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
+
 void __init int rcu_start_callback_processing(void)
 {
+       rcu_start_cbthreads();
        rcu_timer_start();
        rcu_scheduler_active = 1;
 
@@ -523,6 +872,82 @@ void __init int rcu_start_callback_processing(void)
 static int rcu_priority;
 static struct task_struct *rcu_daemon;
 
+/*
+ * Expedited grace periods.  While any synchronize_sched_expedited() is
+ * waiting, jrcud polls every RCU_EXPEDITED_US and, before each pass,
+ * asks every other online cpu for an immediate end-of-batch consent.
+ *
+ * A cpu interrupted outside of any rcu-sched read-side critical section
+ * consents on the spot; any other cpu is told to reschedule, which makes
+ * it consent as soon as it leaves the critical section.  Waiting for the
+ * IPIs also guarantees that no cpu is still appending to the previous
+ * batch, which is what the period otherwise has to be long enough for.
+ * That includes cpus which already consented: a cpu inside call_rcu_sched()
+ * runs with irqs off and a zero preempt count, so it may have consented
+ * while it is still appending, and only the IPI waits it out.
+ *
+ * The waiter does not queue a callback, which would be invoked behind
+ * the whole backlog of its batch.  It waits for the second end of batch
+ * counted by rcu_eob_seq after it started instead: every cpu has passed
+ * a quiescent state after the first one, so after the reader critical
+ * sections that were running when it started.
+ */
+#define RCU_EXPEDITED_US       (100)
+
+static atomic_t rcu_expedited;
+static DECLARE_WAIT_QUEUE_HEAD(rcu_expedited_wq);
+
+static void rcu_wake_expedited(void)
+{
+       if (atomic_read(&rcu_expedited))
+               wake_up_all(&rcu_expedited_wq);
+}
+
+static void rcu_expedite_ipi(void *unused)
+{
+       int cpu = smp_processor_id();
+
+       if ((preempt_count() & ~HARDIRQ_MASK) <= idle_cpu(cpu))
+               rcu_eob(cpu);
+       else
+               set_need_resched();
+}
+
+static void rcu_expedite_eob(void)
+{
+       preempt_disable();
+       rcu_eob(smp_processor_id());
+       smp_call_function(rcu_expedite_ipi, NULL, 1);
+       rcu_stats.nexpedited_passes++;
+       preempt_enable();
+}
+
+void synchronize_sched_expedited(void)
+{
+       struct task_struct *daemon = ACCESS_ONCE(rcu_daemon);
+       unsigned long target;
+
+       if (!rcu_scheduler_active)
+               return;
+
+       /* still driven by the timer, early in boot */
+       if (!daemon) {
+               synchronize_sched();
+               return;
+       }
+
+       atomic_inc(&rcu_expedited);
+       smp_mb(); /* order the caller's accesses before the snapshot */
+       target = ACCESS_ONCE(rcu_eob_seq) + 2;
+       wake_up_process(daemon);
+       wait_event(rcu_expedited_wq,
+               (long)(ACCESS_ONCE(rcu_eob_seq) - target) >= 0);
+       smp_mb(); /* and the grace period before what the caller does next */
+       atomic_dec(&rcu_expedited);
+       atomic_inc(&rcu_stats.nexpedited);
+}
+EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
+
 static int jrcu_set_priority(int priority)
 {
        struct sched_param param;
@@ -550,12 +975,15 @@ static int jrcud_func(void *arg)
        pr_info("JRCU: callback processing via daemon started.\n");
 
        while (!kthread_should_stop()) {
-               if (rcu_hz_precise) {
-                       usleep_range(rcu_hz_period_us,
-                               rcu_hz_period_us);
+               if (atomic_read(&rcu_expedited)) {
+                       usleep_range(RCU_EXPEDITED_US, RCU_EXPEDITED_US);
+                       rcu_expedite_eob();
+               } else if (rcu_hz_precise) {
+                       usleep_range(rcu_period_us,
+                               rcu_period_us);
                } else {
-                       usleep_range(rcu_hz_period_us,
-                               rcu_hz_period_us + rcu_hz_delta_us);
+                       usleep_range(rcu_period_us,
+                               rcu_period_us + rcu_hz_delta_us);
                }
                rcu_delimit_batches();
        }
@@ -571,6 +999,8 @@ static __init int rcu_start_callback_processing(void)
 {
        struct task_struct *p;
 
+       rcu_start_cbthreads();
+
        p = kthread_run(jrcud_func, NULL, "jrcud");
        if (IS_ERR(p)) {
                pr_warn("JRCU: cannot replace callback timer with a daemon\n");
@@ -599,15 +1029,27 @@ static int rcu_hz = RCU_HZ;
 static int rcu_debugfs_show(struct seq_file *m, void *unused)
 {
        int cpu, q;
-       s64 nqueued;
+       s64 nqueued, ninvoked;
 
        nqueued = 0;
-       for_each_present_cpu(cpu)
+       ninvoked = rcu_stats.ninvoked;
+       for_each_present_cpu(cpu) {
                nqueued += rcu_data[cpu].nqueued;
+#ifdef CONFIG_JRCU_OFFLOAD
+               ninvoked += rcu_data[cpu].ninvoked;
+#endif
+       }
 
        seq_printf(m, "%14u: hz, %s\n",
                rcu_hz,
                rcu_hz_precise ? "precise" : "sloppy");
+       seq_printf(m, "%14u: period in effect (usecs)\n", rcu_period_us);
+       seq_printf(m, "%14d: backlog that shortens the period (0 is never)\n",
+               rcu_backlog_hi);
+       seq_printf(m, "%14d: batch limit (0 is none)\n", rcu_batch_limit);
+#ifdef CONFIG_JRCU_OFFLOAD
+       seq_printf(m, "%14s: callback offload\n", rcu_offload ? "on" : "off");
+#endif
 
        seq_printf(m, "%14u: watchdog (secs)\n", rcu_wdog_lim / (int)USEC_PER_SEC);
        seq_printf(m, "%14d: #secs left on watchdog\n",
@@ -639,10 +1081,26 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
                atomic_read(&rcu_stats.nbarriers));
        seq_printf(m, "%14u: #syncs\n",
                atomic_read(&rcu_stats.nsyncs));
+       seq_printf(m, "%14u: #expedited syncs\n",
+               atomic_read(&rcu_stats.nexpedited));
+       seq_printf(m, "%14u: #passes that forced quiescent states\n",
+               rcu_stats.nexpedited_passes);
        seq_printf(m, "%14llu: #callbacks invoked\n",
-               rcu_stats.ninvoked);
+               ninvoked);
        seq_printf(m, "%14d: #callbacks left to invoke\n",
-               (int)(nqueued - rcu_stats.ninvoked));
+               (int)(nqueued - ninvoked));
+       seq_printf(m, "%14u: most callbacks left at an end-of-batch\n",
+               rcu_stats.backlog_max);
+       seq_printf(m, "%14u: #invocation passes cut short by the batch limit\n",
+               rcu_stats.nlimited);
+       seq_printf(m, "%14llu: usecs spent invoking callbacks\n",
+               rcu_stats.run_us);
+       seq_printf(m, "%14u: longest invocation pass (usecs)\n",
+               rcu_stats.run_max_us);
+#ifdef CONFIG_JRCU_OFFLOAD
+       seq_printf(m, "%14u: longest wait for a jrcuc thread (usecs)\n",
+               rcu_stats.offload_max_us);
+#endif
        seq_printf(m, "\n");
 
        for_each_online_cpu(cpu)
@@ -719,6 +1177,23 @@ next:
                        return -EINVAL;
                rcu_hz = rcu_hz_wanted;
                rcu_hz_period_us = USEC_PER_SEC / rcu_hz;
+               rcu_period_us = rcu_hz_period_us;
+       } else if (!strncmp(token, "batch=", 6)) {
+               int batch = -1;
+               sscanf(&token[6], "%d", &batch);
+               if (batch < 0)
+                       return -EINVAL;
+               rcu_batch_limit = batch;
+       } else if (!strncmp(token, "backlog=", 8)) {
+               int backlog = -1;
+               sscanf(&token[8], "%d", &backlog);
+               if (backlog < 0)
+                       return -EINVAL;
+               rcu_backlog_hi = backlog;
+#ifdef CONFIG_JRCU_OFFLOAD
+       } else if (!strncmp(token, "offload=", 8)) {
+               sscanf(&token[8], "%d", &rcu_offload);
+#endif
        } else if (!strncmp(token, "precise=", 8)) {
                sscanf(&token[8], "%d", &rcu_hz_precise);
        } else if (!strncmp(token, "wdog=", 5)) {
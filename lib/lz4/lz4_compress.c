@@ -0,0 +1,139 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Single pass greedy compressor producing the LZ4 block format
+ *  (see lz4defs.h). Candidate matches are found through a small hash
+ *  table of 4-byte sequences; the search step grows on data that does
+ *  not compress, so incompressible input costs little.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/* Little endian load keeps the output identical on all architectures */
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned_le32(p) * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+
+	return op;
+}
+
+static inline unsigned char *lz4_put_literals(unsigned char *op,
+		unsigned char *token, const unsigned char *anchor, size_t len)
+{
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		*token = len << ML_BITS;
+	}
+
+	memcpy(op, anchor, len);
+	return op + len;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+	size_t len;
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	memset(hash_table, 0, HASHTABLESIZE * sizeof(*hash_table));
+	hash_table[lz4_hash(ip)] = 0;
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *ref;
+		unsigned int search = 1 << SKIPSTRENGTH;
+		u32 h;
+
+		/* Find a match */
+		for (;;) {
+			h = lz4_hash(ip);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+
+			if (ref < ip && ip - ref <= MAX_DISTANCE &&
+			    get_unaligned((const u32 *)ref) ==
+			    get_unaligned((const u32 *)ip))
+				break;
+
+			ip += search++ >> SKIPSTRENGTH;
+			if (ip >= mflimit)
+				goto last_literals;
+		}
+
+		/* Catch up with matching bytes before the hashed position */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		token = op++;
+		op = lz4_put_literals(op, token, anchor, ip - anchor);
+
+		/* Offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Match length */
+		ip += MINMATCH;
+		ref += MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - anchor;
+		if (len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token |= len;
+		}
+
+		anchor = ip;
+		if (ip >= mflimit)
+			break;
+
+		/* Fill the table with a position inside the match */
+		hash_table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	token = op++;
+	op = lz4_put_literals(op, token, anchor, iend - anchor);
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,104 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Safe decoder for the LZ4 block format (see lz4defs.h): every
+ *  length and offset is checked against the input and output buffers,
+ *  so corrupted data results in an error rather than a memory overrun.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/*
+ * Read the extra bytes of a length field. Returns 0 if the input ends
+ * before the length is complete.
+ */
+static inline int lz4_get_length(const unsigned char **ip,
+		const unsigned char *iend, size_t *len)
+{
+	unsigned int s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return 0;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 1;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char * const oend = dest + *dest_len;
+
+	while (ip < iend) {
+		const unsigned char *ref;
+		unsigned int token;
+		size_t len, offset;
+
+		token = *ip++;
+
+		/* Literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && !lz4_get_length(&ip, iend, &len))
+			goto malformed;
+		if (unlikely(len > iend - ip || len > oend - op))
+			goto malformed;
+
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match part */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > op - dest))
+			goto malformed;
+		ref = op - offset;
+
+		/* Match */
+		len = token & ML_MASK;
+		if (len == ML_MASK && !lz4_get_length(&ip, iend, &len))
+			goto malformed;
+		len += MINMATCH;
+		if (unlikely(len > oend - op))
+			goto malformed;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping copy: repeats the last 'offset' bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return 0;
+
+malformed:
+	return -1;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,34 @@
+/*
+ *  lz4defs.h -- common definitions for the LZ4 block format
+ *
+ *  LZ4 - Fast LZ compression algorithm
+ *  Format designed by Yann Collet, http://code.google.com/p/lz4/
+ *
+ *  A block is a sequence of (token, literals, offset, match) tuples.
+ *  The high nibble of the token is the literal run length, the low
+ *  nibble the match length minus MINMATCH; a nibble of 15 is followed
+ *  by extra length bytes, each 255 meaning "more follows". The last
+ *  sequence only carries literals.
+ */
+
+#define MINMATCH	4
+
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MINLENGTH	(MFLIMIT + 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAXD_LOG	16
+#define MAX_DISTANCE	((1 << MAXD_LOG) - 1)
+
+/* Hash table of u32 positions: must fit in LZ4_MEM_COMPRESS */
+#define HASH_LOG	12
+#define HASHTABLESIZE	(1 << HASH_LOG)
+
+/* Skip ahead faster on incompressible data */
+#define SKIPSTRENGTH	6
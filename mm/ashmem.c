@@ -29,6 +29,11 @@
 #include <linux/mutex.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
+#include <linux/sort.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
 #include <asm/cacheflush.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
@@ -49,6 +54,7 @@ struct ashmem_area {
 	unsigned long vm_start;		/* Start address of vm_area
 					 * which maps this ashmem */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	atomic_t purging;		/* ranges the shrinker is truncating */
 };
 
 /*
@@ -78,6 +84,43 @@ static unsigned long lru_count;
  */
 static DEFINE_MUTEX(ashmem_mutex);
 
+/*
+ * The shrinker takes ranges off the LRU under ashmem_mutex but truncates
+ * them after dropping it, ASHMEM_PURGE_BATCH ranges at a time. Each range
+ * taken counts in its area's 'purging', which only goes up under
+ * ashmem_mutex. Pinning sees it under the mutex and backs off until it is
+ * zero, so that a range that was reported as purged cannot be truncated
+ * after the user refilled it. Release waits for it too, which keeps the
+ * area and its backing file around for the shrinker without a reference
+ * of its own, so reclaim never drops the last one.
+ */
+#define ASHMEM_PURGE_BATCH	16
+
+/* how far down the LRU we look for a big range with purge_large set */
+#define ASHMEM_PURGE_SCAN	64
+
+struct ashmem_purge {
+	struct ashmem_area *asma;	/* kept alive by asma->purging */
+	loff_t start;			/* first byte, inclusive */
+	loff_t end;			/* last byte, inclusive */
+};
+
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_purge_wait);
+
+/* purge the biggest of the oldest ranges first instead of the oldest */
+static unsigned int ashmem_purge_large;
+
+/* purge statistics, protected by ashmem_stats_lock */
+static DEFINE_SPINLOCK(ashmem_stats_lock);
+static struct {
+	unsigned long ranges;		/* ranges purged */
+	unsigned long pages;		/* pages purged */
+	unsigned long batches;		/* trips outside ashmem_mutex */
+	unsigned long contended;	/* shrinks that found the mutex held */
+	u64 time_us;			/* time spent truncating */
+	unsigned long max_us;		/* longest batch */
+} ashmem_stats;
+
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
@@ -208,6 +251,9 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 		range_del(range);
 	mutex_unlock(&ashmem_mutex);
 
+	/* the shrinker may still be truncating ranges it took before */
+	wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
+
 	if (asma->file)
 		fput(asma->file);
 	kmem_cache_free(ashmem_area_cachep, asma);
@@ -337,6 +383,78 @@ out:
 	return ret;
 }
 
+/*
+ * lru_pick - returns the next range to purge, NULL if the LRU is empty
+ *
+ * Caller must hold ashmem_mutex.
+ */
+static struct ashmem_range *lru_pick(void)
+{
+	struct ashmem_range *range, *best = NULL;
+	int scanned = 0;
+
+	list_for_each_entry(range, &ashmem_lru_list, lru) {
+		if (!best || range_size(range) > range_size(best))
+			best = range;
+		if (!ashmem_purge_large || ++scanned >= ASHMEM_PURGE_SCAN)
+			break;
+	}
+
+	return best;
+}
+
+static int ashmem_purge_cmp(const void *a, const void *b)
+{
+	const struct ashmem_purge *pa = a, *pb = b;
+
+	if (pa->asma == pb->asma)
+		return 0;
+	return pa->asma < pb->asma ? -1 : 1;
+}
+
+/*
+ * ashmem_purge_batch - truncates the given ranges and lets their areas go
+ *
+ * Ranges of the same inode are truncated under a single i_mutex hold.
+ * Caller must not hold ashmem_mutex.
+ */
+static void ashmem_purge_batch(struct ashmem_purge *batch, int nr)
+{
+	int i, j;
+
+	sort(batch, nr, sizeof(*batch), ashmem_purge_cmp, NULL);
+
+	for (i = 0; i < nr; i = j) {
+		struct inode *inode = batch[i].asma->file->f_dentry->d_inode;
+		struct address_space *mapping = inode->i_mapping;
+
+		for (j = i; j < nr && batch[j].asma == batch[i].asma; j++)
+			;
+		if (!inode->i_op->truncate_range)
+			continue;
+
+		/* what vmtruncate_range does, once per inode */
+		mutex_lock(&inode->i_mutex);
+		down_write(&inode->i_alloc_sem);
+		for (j = i; j < nr && batch[j].asma == batch[i].asma; j++) {
+			loff_t start = batch[j].start;
+			loff_t end = batch[j].end;
+
+			unmap_mapping_range(mapping, start, end - start, 1);
+			inode->i_op->truncate_range(inode, start, end);
+			/* unmap again to remove racily COWed private pages */
+			unmap_mapping_range(mapping, start, end - start, 1);
+		}
+		up_write(&inode->i_alloc_sem);
+		mutex_unlock(&inode->i_mutex);
+	}
+
+	/* release may free an area as soon as it sees it drop to zero */
+	for (i = 0; i < nr; i++)
+		atomic_dec(&batch[i].asma->purging);
+	wake_up_all(&ashmem_purge_wait);
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -349,36 +467,66 @@ out:
  * proceed without risk of deadlock (due to gfp_mask).
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * chunks of ashmem regions LRU-wise until we hit 'nr_to_scan' pages freed.
+ * ashmem_mutex is only held to take ranges off the LRU, never across the
+ * truncation itself, and is never waited for: if it is held, we may be
+ * recursing into ourselves, so we bail out with -1.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_purge batch[ASHMEM_PURGE_BATCH];
+	long nr_to_scan = sc->nr_to_scan;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+	if (nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
+	if (!nr_to_scan)
 		return lru_count;
 
-	/* If our mutex is held, we are recursing into ourselves, so bail out */
 	if (!mutex_trylock(&ashmem_mutex)) {
+		spin_lock(&ashmem_stats_lock);
+		ashmem_stats.contended++;
+		spin_unlock(&ashmem_stats_lock);
 		return -1;
 	}
 
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+	while (nr_to_scan > 0 && !list_empty(&ashmem_lru_list)) {
+		struct ashmem_range *range;
+		unsigned long pages = 0;
+		unsigned long us;
+		ktime_t start;
+		int nr = 0;
+
+		while (nr < ASHMEM_PURGE_BATCH && nr_to_scan > 0 &&
+		       (range = lru_pick())) {
+			batch[nr].asma = range->asma;
+			atomic_inc(&range->asma->purging);
+			batch[nr].start = range->pgstart * PAGE_SIZE;
+			batch[nr].end = (range->pgend + 1) * PAGE_SIZE - 1;
+			nr++;
+
+			range->purged = ASHMEM_WAS_PURGED;
+			lru_del(range);
+			pages += range_size(range);
+			nr_to_scan -= range_size(range);
+		}
+		mutex_unlock(&ashmem_mutex);
+
+		start = ktime_get();
+		ashmem_purge_batch(batch, nr);
+		us = ktime_us_delta(ktime_get(), start);
+
+		spin_lock(&ashmem_stats_lock);
+		ashmem_stats.ranges += nr;
+		ashmem_stats.pages += pages;
+		ashmem_stats.batches++;
+		ashmem_stats.time_us += us;
+		if (us > ashmem_stats.max_us)
+			ashmem_stats.max_us = us;
+		spin_unlock(&ashmem_stats_lock);
+
+		if (!mutex_trylock(&ashmem_mutex))
+			return -1;
 	}
 	mutex_unlock(&ashmem_mutex);
 
@@ -616,8 +764,16 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
+retry:
 	mutex_lock(&ashmem_mutex);
 
+	/* don't let a purge in flight truncate pages we are about to pin */
+	if (atomic_read(&asma->purging)) {
+		mutex_unlock(&ashmem_mutex);
+		wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
+		goto retry;
+	}
+
 	switch (cmd) {
 	case ASHMEM_PIN:
 		ret = ashmem_pin(asma, pgstart, pgend);
@@ -810,6 +966,69 @@ void put_ashmem_file(struct file *file)
 }
 EXPORT_SYMBOL(put_ashmem_file);
 
+#ifdef CONFIG_SYSFS
+#define ASHMEM_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define ASHMEM_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t purge_large_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ashmem_purge_large);
+}
+
+static ssize_t purge_large_store(struct kobject *kobj,
+				 struct kobj_attribute *attr,
+				 const char *buf, size_t count)
+{
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	ashmem_purge_large = !!val;
+	return count;
+}
+ASHMEM_ATTR(purge_large);
+
+static ssize_t lru_pages_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", lru_count);
+}
+ASHMEM_ATTR_RO(lru_pages);
+
+static ssize_t purge_stats_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	spin_lock(&ashmem_stats_lock);
+	ret = sprintf(buf, "ranges %lu\npages %lu\nbatches %lu\n"
+		      "contended %lu\ntime_us %llu\nmax_us %lu\n",
+		      ashmem_stats.ranges, ashmem_stats.pages,
+		      ashmem_stats.batches, ashmem_stats.contended,
+		      (unsigned long long)ashmem_stats.time_us,
+		      ashmem_stats.max_us);
+	spin_unlock(&ashmem_stats_lock);
+	return ret;
+}
+ASHMEM_ATTR_RO(purge_stats);
+
+static struct attribute *ashmem_attrs[] = {
+	&purge_large_attr.attr,
+	&lru_pages_attr.attr,
+	&purge_stats_attr.attr,
+	NULL,
+};
+
+static struct attribute_group ashmem_attr_group = {
+	.attrs = ashmem_attrs,
+	.name = "ashmem",
+};
+#endif /* CONFIG_SYSFS */
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -855,6 +1074,11 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &ashmem_attr_group))
+		printk(KERN_ERR "ashmem: failed to register sysfs group\n");
+#endif
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -866,6 +1090,10 @@ static void __exit ashmem_exit(void)
 
 	unregister_shrinker(&ashmem_shrinker);
 
+#ifdef CONFIG_SYSFS
+	sysfs_remove_group(mm_kobj, &ashmem_attr_group);
+#endif
+
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
 		printk(KERN_ERR "ashmem: failed to unregister misc device!\n");
@@ -32,6 +32,7 @@
 #include <linux/mempolicy.h>
 #include <linux/security.h>
 #include <linux/ptrace.h>
+#include <linux/lowmemorykiller.h>
 
 int sysctl_panic_on_oom;
 int sysctl_oom_kill_allocating_task;
@@ -61,6 +62,7 @@ int test_set_oom_score_adj(int new_val)
 		current->signal->oom_score_adj = new_val;
 	}
 	spin_unlock_irq(&sighand->siglock);
+	lowmem_task_adj_changed(current);
 
 	return old_val;
 }
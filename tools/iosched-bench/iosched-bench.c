@@ -0,0 +1,499 @@
+/*
+ * iosched-bench: compare I/O schedulers on one block device
+ *
+ * For every scheduler offered by /sys/block/<dev>/queue/scheduler (or those
+ * given with -s) the scheduler is switched in, the caches of the device are
+ * dropped and a mixed workload is run: sync O_DIRECT reads, whose latency
+ * is recorded, against buffered writes that the flusher or sync_file_range
+ * pushes out asynchronously. The reads are what an interactive task would
+ * wait on, so throughput is reported for both sides and percentiles only
+ * for the reads.
+ *
+ * Without a trace, each reader issues random reads of -b bytes back to back
+ * and one writer streams -w byte writes for -t seconds. A trace replays
+ * recorded I/O instead, one request per line:
+ *
+ *	<usecs from start> <R|W> <byte offset> <bytes>
+ *
+ * Requests are issued at their timestamps, or at once when replay falls
+ * behind. Reads go through O_DIRECT, so their offsets and sizes must be
+ * multiples of 512. Lines starting with '#' are ignored.
+ *
+ * Meant for the flashram driver (CONFIG_BLK_DEV_FLASHRAM), but any block
+ * device whose contents may be destroyed will do:
+ *
+ *	modprobe flashram
+ *	iosched-bench -d flashram0 -t 20 -r 2
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#define MAX_SCHEDS	16
+#define MAX_READERS	64
+#define SYNC_CHUNK	(1 << 20)
+
+struct trace_op {
+	uint64_t	at_us;
+	uint64_t	offset;
+	uint32_t	bytes;
+	char		op;
+};
+
+struct trace {
+	struct trace_op	*ops;
+	size_t		nr;
+};
+
+struct worker {
+	pthread_t	thread;
+	int		id;
+	uint64_t	bytes;
+	uint64_t	*lat;		/* read latencies in usecs */
+	size_t		nr_lat;
+	size_t		max_lat;
+};
+
+static const char *dev_name;
+static char dev_path[256];
+static uint64_t dev_size;
+static int duration = 10;
+static int nr_readers = 1;
+static uint32_t read_bs = 4096;
+static uint32_t write_bs = 65536;
+static struct trace trace;
+static volatile int stop;
+static uint64_t start_us;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *xalign(size_t size)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, size))
+		die("posix_memalign");
+	memset(buf, 0x5a, size);
+	return buf;
+}
+
+static void record_lat(struct worker *w, uint64_t us)
+{
+	if (w->nr_lat == w->max_lat) {
+		w->max_lat = w->max_lat ? w->max_lat * 2 : 4096;
+		w->lat = realloc(w->lat, w->max_lat * sizeof(*w->lat));
+		if (!w->lat)
+			die("realloc");
+	}
+	w->lat[w->nr_lat++] = us;
+}
+
+/* sleep until a trace op is due, returns nonzero once the run is over */
+static int wait_for(uint64_t at_us)
+{
+	uint64_t now = now_us() - start_us;
+
+	if (at_us > now)
+		usleep(at_us - now);
+	return stop;
+}
+
+static void *reader(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int seed = w->id * 7919 + 1;
+	uint32_t max_bs = read_bs;
+	char *buf;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < trace.nr; i++)
+		if (trace.ops[i].op == 'R' && trace.ops[i].bytes > max_bs)
+			max_bs = trace.ops[i].bytes;
+	buf = xalign(max_bs);
+
+	fd = open(dev_path, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		die(dev_path);
+
+	if (trace.nr) {
+		/* readers take every nr_readers'th read of the trace */
+		size_t n = 0;
+
+		for (i = 0; i < trace.nr && !stop; i++) {
+			struct trace_op *op = &trace.ops[i];
+			uint64_t t;
+
+			if (op->op != 'R' || n++ % nr_readers != (size_t)w->id)
+				continue;
+			if (wait_for(op->at_us))
+				break;
+			t = now_us();
+			if (pread(fd, buf, op->bytes, op->offset) < 0)
+				die("pread");
+			record_lat(w, now_us() - t);
+			w->bytes += op->bytes;
+		}
+	} else {
+		uint64_t blocks = dev_size / read_bs;
+
+		while (!stop) {
+			off_t off = (off_t)(rand_r(&seed) % blocks) * read_bs;
+			uint64_t t = now_us();
+
+			if (pread(fd, buf, read_bs, off) < 0)
+				die("pread");
+			record_lat(w, now_us() - t);
+			w->bytes += read_bs;
+		}
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t synced = 0, off = 0;
+	uint32_t max_bs = write_bs;
+	char *buf;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < trace.nr; i++)
+		if (trace.ops[i].op == 'W' && trace.ops[i].bytes > max_bs)
+			max_bs = trace.ops[i].bytes;
+	buf = xalign(max_bs);
+
+	fd = open(dev_path, O_WRONLY);
+	if (fd < 0)
+		die(dev_path);
+
+	for (i = 0; !stop; i++) {
+		uint32_t bytes = write_bs;
+
+		if (trace.nr) {
+			struct trace_op *op;
+
+			while (i < trace.nr && trace.ops[i].op != 'W')
+				i++;
+			if (i == trace.nr)
+				break;
+			op = &trace.ops[i];
+			if (wait_for(op->at_us))
+				break;
+			off = op->offset;
+			bytes = op->bytes;
+		} else if (off + bytes > dev_size) {
+			off = 0;
+		}
+
+		if (pwrite(fd, buf, bytes, off) < 0)
+			die("pwrite");
+		off += bytes;
+		w->bytes += bytes;
+
+		/* start writeback without waiting for it, like a flusher */
+		if (w->bytes - synced >= SYNC_CHUNK) {
+			sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+			synced = w->bytes;
+		}
+	}
+
+	fdatasync(fd);
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int read_sysfs(const char *path, char *buf, size_t len)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+static int write_sysfs(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return -1;
+	n = write(fd, val, strlen(val));
+	close(fd);
+	return n < 0 ? -1 : 0;
+}
+
+/* splits a "noop [deadline] cfq" or "noop,cfq" list into names */
+static int split_scheds(char *list, char **names)
+{
+	int n = 0;
+	char *tok;
+
+	for (tok = strtok(list, " ,[]\n"); tok && n < MAX_SCHEDS;
+	     tok = strtok(NULL, " ,[]\n"))
+		names[n++] = tok;
+	return n;
+}
+
+static void load_trace(const char *path)
+{
+	char line[256];
+	size_t max = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		die(path);
+
+	while (fgets(line, sizeof(line), f)) {
+		struct trace_op op;
+		unsigned long long at, offset;
+		unsigned int bytes;
+		char c;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%llu %c %llu %u", &at, &c, &offset,
+			   &bytes) != 4 || (c != 'R' && c != 'W') || !bytes ||
+		    (c == 'R' && (offset % 512 || bytes % 512))) {
+			fprintf(stderr, "%s: bad line: %s", path, line);
+			exit(1);
+		}
+		op.at_us = at;
+		op.op = c;
+		op.offset = offset;
+		op.bytes = bytes;
+		if (op.offset + op.bytes > dev_size) {
+			fprintf(stderr, "%s: beyond end of device: %s",
+				path, line);
+			exit(1);
+		}
+
+		if (trace.nr == max) {
+			max = max ? max * 2 : 1024;
+			trace.ops = realloc(trace.ops, max * sizeof(op));
+			if (!trace.ops)
+				die("realloc");
+		}
+		trace.ops[trace.nr++] = op;
+	}
+	fclose(f);
+}
+
+static void drop_caches(void)
+{
+	int fd = open(dev_path, O_RDONLY);
+
+	if (fd < 0)
+		die(dev_path);
+	fsync(fd);
+	if (ioctl(fd, BLKFLSBUF, 0) < 0)
+		perror("BLKFLSBUF");
+	close(fd);
+}
+
+static void run(const char *sched)
+{
+	struct worker readers[MAX_READERS], wr;
+	uint64_t *lat, rbytes = 0, elapsed;
+	size_t nr_lat = 0;
+	char path[256];
+	int i;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/scheduler",
+		 dev_name);
+	if (write_sysfs(path, sched)) {
+		fprintf(stderr, "%-12s cannot select: %s\n", sched,
+			strerror(errno));
+		return;
+	}
+	drop_caches();
+
+	memset(readers, 0, sizeof(readers));
+	memset(&wr, 0, sizeof(wr));
+	stop = 0;
+	start_us = now_us();
+
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].id = i;
+		if (pthread_create(&readers[i].thread, NULL, reader,
+				   &readers[i]))
+			die("pthread_create");
+	}
+	if (pthread_create(&wr.thread, NULL, writer, &wr))
+		die("pthread_create");
+
+	if (!trace.nr) {
+		sleep(duration);
+		stop = 1;
+	}
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		rbytes += readers[i].bytes;
+		nr_lat += readers[i].nr_lat;
+	}
+	/* the writer only returns once its data has reached the device */
+	pthread_join(wr.thread, NULL);
+	elapsed = now_us() - start_us;
+
+	lat = malloc((nr_lat + 1) * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+	nr_lat = 0;
+	for (i = 0; i < nr_readers; i++) {
+		memcpy(lat + nr_lat, readers[i].lat,
+		       readers[i].nr_lat * sizeof(*lat));
+		nr_lat += readers[i].nr_lat;
+		free(readers[i].lat);
+	}
+	qsort(lat, nr_lat, sizeof(*lat), cmp_u64);
+	if (!nr_lat)
+		lat[0] = 0;
+
+	printf("%-12s %8.0f %9.2f %8llu %8llu %8llu %9.2f\n", sched,
+	       nr_lat * 1e6 / elapsed, rbytes / (double)elapsed,
+	       (unsigned long long)lat[nr_lat / 2],
+	       (unsigned long long)lat[nr_lat ? nr_lat * 99 / 100 : 0],
+	       (unsigned long long)lat[nr_lat ? nr_lat - 1 : 0],
+	       wr.bytes / (double)elapsed);
+	fflush(stdout);
+	free(lat);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d <dev> [-s sched,...] [-t secs] [-r readers]\n"
+		"          [-b read_bytes] [-w write_bytes] [-f trace]\n"
+		"  -d  block device name under /sys/block, e.g. flashram0\n"
+		"  -s  schedulers to run, default: all offered by the queue\n"
+		"  -t  seconds per scheduler without a trace (%d)\n"
+		"  -r  reader threads (%d)\n"
+		"  -b  random read size (%u)\n"
+		"  -w  sequential write size (%u)\n"
+		"  -f  replay \"usecs R|W offset bytes\" lines instead\n",
+		prog, duration, nr_readers, read_bs, write_bs);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *names[MAX_SCHEDS], avail[512], orig[64], path[256];
+	const char *sched_list = NULL, *trace_path = NULL;
+	int i, n, c, fd;
+
+	while ((c = getopt(argc, argv, "d:s:t:r:b:w:f:h")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 's':
+			sched_list = optarg;
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'b':
+			read_bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			trace_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev_name || duration <= 0 || nr_readers <= 0 ||
+	    nr_readers > MAX_READERS || !read_bs || read_bs % 512 ||
+	    !write_bs)
+		usage(argv[0]);
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s", dev_name);
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0)
+		die(dev_path);
+	if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0)
+		die("BLKGETSIZE64");
+	close(fd);
+	if (dev_size < read_bs || dev_size < write_bs) {
+		fprintf(stderr, "%s: device too small\n", dev_path);
+		return 1;
+	}
+
+	if (trace_path)
+		load_trace(trace_path);
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/scheduler",
+		 dev_name);
+	if (read_sysfs(path, avail, sizeof(avail)))
+		die(path);
+	/* remember the active scheduler to put it back afterwards */
+	orig[0] = '\0';
+	if (strchr(avail, '['))
+		sscanf(strchr(avail, '[') + 1, "%63[^]]", orig);
+
+	n = split_scheds(sched_list ? strdup(sched_list) : avail, names);
+	if (!n)
+		usage(argv[0]);
+
+	printf("%-12s %8s %9s %8s %8s %8s %9s\n", "scheduler", "rd iops",
+	       "rd MB/s", "p50 us", "p99 us", "max us", "wr MB/s");
+	for (i = 0; i < n; i++)
+		run(names[i]);
+
+	if (orig[0])
+		write_sysfs(path, orig);
+	return 0;
+}